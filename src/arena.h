@@ -0,0 +1,156 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// Bump allocator for objects that are all released together. Reset discards
+// every allocation at once, without visiting them, and keeps the chunks for
+// reuse. Destructors are never run, so objects placed here must not own
+// other memory unless their owner releases it before the reset.
+
+class ARENA
+{
+public:
+
+    ARENA(size_t chunkSize = 1 << 20)
+    :   ChunkSize(chunkSize),
+        Current(0),
+        Offset(0),
+        NumAllocated(0)
+    {
+    }
+
+    ~ARENA()
+    {
+        DeleteAll();
+    }
+
+    // Allocate may be called concurrently by parallel search threads
+    void* Allocate(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        for (;;)
+        {
+            if (Current < Chunks.size())
+            {
+                size_t start = (Offset + Align - 1) & ~(Align - 1);
+                if (start + bytes <= Chunks[Current].Size)
+                {
+                    Offset = start + bytes;
+                    NumAllocated += bytes;
+                    return Chunks[Current].Memory + start;
+                }
+                // Chunks are handed out in order, so a request that does
+                // not fit here moves on to the next one
+                if (Current + 1 < Chunks.size())
+                {
+                    Current++;
+                    Offset = 0;
+                    continue;
+                }
+            }
+            NewChunk(bytes);
+        }
+    }
+
+    // Release everything allocated since the last reset
+    void Reset()
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        Current = 0;
+        Offset = 0;
+        NumAllocated = 0;
+    }
+
+    // Exchange all chunks and allocations with another arena
+    void Swap(ARENA& arena)
+    {
+        std::lock(Mutex, arena.Mutex);
+        std::lock_guard<std::mutex> lock(Mutex, std::adopt_lock);
+        std::lock_guard<std::mutex> otherLock(arena.Mutex, std::adopt_lock);
+        std::swap(ChunkSize, arena.ChunkSize);
+        Chunks.swap(arena.Chunks);
+        std::swap(Current, arena.Current);
+        std::swap(Offset, arena.Offset);
+        std::swap(NumAllocated, arena.NumAllocated);
+    }
+
+    // Take over the chunks holding another arena's allocations, without
+    // copying them, leaving it empty. They are reused here after the next
+    // reset; this arena goes on allocating from its own chunks until then.
+    void Absorb(ARENA& arena)
+    {
+        std::lock(Mutex, arena.Mutex);
+        std::lock_guard<std::mutex> lock(Mutex, std::adopt_lock);
+        std::lock_guard<std::mutex> otherLock(arena.Mutex, std::adopt_lock);
+        if (arena.NumAllocated == 0)
+            return;
+        // Absorbed chunks go before the one being allocated from, or are
+        // all full if there is none
+        size_t used = arena.Current + 1;
+        bool own = !Chunks.empty();
+        Chunks.insert(Chunks.begin() + Current, arena.Chunks.begin(), arena.Chunks.begin() + used);
+        arena.Chunks.erase(arena.Chunks.begin(), arena.Chunks.begin() + used);
+        if (own)
+            Current += used;
+        else
+        {
+            Current = used - 1;
+            Offset = Chunks[Current].Size;
+        }
+        NumAllocated += arena.NumAllocated;
+        arena.Current = 0;
+        arena.Offset = 0;
+        arena.NumAllocated = 0;
+    }
+
+    void DeleteAll()
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        for (size_t i = 0; i < Chunks.size(); ++i)
+            delete [] Chunks[i].Memory;
+        Chunks.clear();
+        Current = 0;
+        Offset = 0;
+        NumAllocated = 0;
+    }
+
+    // Bytes handed out since the last reset
+    size_t GetNumAllocated() const { return NumAllocated; }
+
+private:
+
+    // Alignment of every allocation; operator new[] aligns chunks at least
+    // this strictly
+    static const size_t Align = 16;
+
+    struct CHUNK
+    {
+        char* Memory;
+        size_t Size;
+    };
+
+    void NewChunk(size_t minSize)
+    {
+        CHUNK chunk;
+        chunk.Size = minSize > ChunkSize ? minSize : ChunkSize;
+        chunk.Memory = new char[chunk.Size];
+        if (!Chunks.empty())
+            Current++;
+        Chunks.insert(Chunks.begin() + Current, chunk);
+        Offset = 0;
+    }
+
+    size_t ChunkSize;
+    std::vector<CHUNK> Chunks;
+    size_t Current, Offset;
+    size_t NumAllocated;
+    std::mutex Mutex;
+};
+
+#endif // ARENA_H
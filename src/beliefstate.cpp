@@ -1,5 +1,6 @@
 #include "beliefstate.h"
 #include "simulator.h"
+#include "testsimulator.h"
 #include "utils.h"
 
 using namespace UTILS;
@@ -17,34 +18,210 @@ void BELIEF_STATE::Free(const SIMULATOR& simulator)
         simulator.FreeState(*i_state);
     }
     Samples.clear();
+    Cumulative.clear();
 }
 
 STATE* BELIEF_STATE::CreateSample(const SIMULATOR& simulator) const
 {
-    int index = Random(Samples.size());
+    int index;
+    if (Cumulative.empty())
+        index = Random(Samples.size());
+    else
+    {
+        double target = RandomDouble(0, Cumulative.back());
+        index = std::upper_bound(Cumulative.begin(), Cumulative.end(), target)
+            - Cumulative.begin();
+        if (index == (int) Samples.size())
+            index--;
+    }
     return simulator.Copy(*Samples[index]);
 }
 
 void BELIEF_STATE::AddSample(STATE* state)
 {
     Samples.push_back(state);
+    if (!Cumulative.empty())
+        Cumulative.push_back(Cumulative.back() + 1);
+}
+
+void BELIEF_STATE::AddSample(STATE* state, double weight)
+{
+    assert(weight >= 0);
+    if (Cumulative.empty())
+        for (int i = 0; i < (int) Samples.size(); i++)
+            Cumulative.push_back(i + 1);
+    Samples.push_back(state);
+    Cumulative.push_back(Samples.size() > 1 ? Cumulative.back() + weight : weight);
 }
 
 void BELIEF_STATE::Copy(const BELIEF_STATE& beliefs, const SIMULATOR& simulator)
 {
-    for (std::vector<STATE*>::const_iterator i_state = beliefs.Samples.begin();
-        i_state != beliefs.Samples.end(); ++i_state)
+    for (int i = 0; i < (int) beliefs.Samples.size(); i++)
     {
-        AddSample(simulator.Copy(**i_state));
+        if (beliefs.Weighted())
+            AddSample(simulator.Copy(*beliefs.Samples[i]), beliefs.GetWeight(i));
+        else
+            AddSample(simulator.Copy(*beliefs.Samples[i]));
     }
 }
 
 void BELIEF_STATE::Move(BELIEF_STATE& beliefs)
 {
-    for (std::vector<STATE*>::const_iterator i_state = beliefs.Samples.begin();
-        i_state != beliefs.Samples.end(); ++i_state)
+    if (Samples.empty())
     {
-        AddSample(*i_state);
+        Samples.swap(beliefs.Samples);
+        Cumulative.swap(beliefs.Cumulative);
+        beliefs.Cumulative.clear();
+        return;
+    }
+    for (int i = 0; i < (int) beliefs.Samples.size(); i++)
+    {
+        if (beliefs.Weighted())
+            AddSample(beliefs.Samples[i], beliefs.GetWeight(i));
+        else
+            AddSample(beliefs.Samples[i]);
     }
     beliefs.Samples.clear();
+    beliefs.Cumulative.clear();
+}
+
+void BELIEF_STATE::Release(std::vector<STATE*>& samples, std::vector<double>& weights)
+{
+    weights.resize(Samples.size());
+    for (int i = 0; i < (int) Samples.size(); i++)
+        weights[i] = GetWeight(i);
+    samples.clear();
+    samples.swap(Samples);
+    Cumulative.clear();
+}
+
+void BELIEF_STATE::Resample(int numSamples, const SIMULATOR& simulator)
+{
+    if (Samples.empty())
+        return;
+
+    // One uniform draw places numSamples evenly spaced pointers along the
+    // cumulative weight
+    double step = GetTotalWeight() / numSamples;
+    double pointer = RandomDouble(0, step);
+    std::vector<STATE*> samples;
+    samples.reserve(numSamples);
+    int index = 0;
+    bool kept = false;
+    for (int i = 0; i < numSamples; i++, pointer += step)
+    {
+        while (index < (int) Samples.size() - 1 && GetCumulative(index) <= pointer)
+        {
+            if (!kept)
+                simulator.FreeState(Samples[index]);
+            index++;
+            kept = false;
+        }
+        samples.push_back(kept ? simulator.Copy(*Samples[index]) : Samples[index]);
+        kept = true;
+    }
+    for (; index < (int) Samples.size(); index++)
+    {
+        if (!kept)
+            simulator.FreeState(Samples[index]);
+        kept = false;
+    }
+    Samples.swap(samples);
+    Cumulative.clear();
+}
+
+double BELIEF_STATE::GetWeight(int index) const
+{
+    if (Cumulative.empty())
+        return 1;
+    return index == 0 ? Cumulative[0] : Cumulative[index] - Cumulative[index - 1];
+}
+
+double BELIEF_STATE::GetTotalWeight() const
+{
+    return Cumulative.empty() ? Samples.size() : Cumulative.back();
+}
+
+double BELIEF_STATE::GetEffectiveSampleSize() const
+{
+    if (Cumulative.empty())
+        return Samples.size();
+    double sumSquares = 0;
+    for (int i = 0; i < (int) Samples.size(); i++)
+        sumSquares += GetWeight(i) * GetWeight(i);
+    return sumSquares > 0 ? Cumulative.back() * Cumulative.back() / sumSquares : 0;
+}
+
+//----------------------------------------------------------------------------
+
+void BELIEF_STATE::UnitTest()
+{
+    // Samples are told apart by depth
+    TEST_SIMULATOR simulator(2, 2, 1);
+    BELIEF_STATE beliefs;
+    for (int depth = 0; depth < 4; depth++)
+    {
+        TEST_STATE* state = new TEST_STATE;
+        state->Depth = depth;
+        beliefs.AddSample(state);
+    }
+    assert(!beliefs.Weighted());
+    assert(beliefs.GetEffectiveSampleSize() == 4);
+
+    // Weights 1, 1, 1, 1, 0, 6
+    TEST_STATE* light = new TEST_STATE;
+    light->Depth = 4;
+    beliefs.AddSample(light, 0);
+    TEST_STATE* heavy = new TEST_STATE;
+    heavy->Depth = 5;
+    beliefs.AddSample(heavy, 6);
+    assert(beliefs.Weighted());
+    assert(beliefs.GetWeight(0) == 1 && beliefs.GetWeight(4) == 0 && beliefs.GetWeight(5) == 6);
+    assert(beliefs.GetTotalWeight() == 10);
+    assert(fabs(beliefs.GetEffectiveSampleSize() - 100.0 / 40) < 1e-12);
+
+    RandomSeed(0);
+    int counts[6] = { 0 };
+    for (int n = 0; n < 10000; n++)
+    {
+        STATE* state = beliefs.CreateSample(simulator);
+        counts[safe_cast<TEST_STATE*>(state)->Depth]++;
+        simulator.FreeState(state);
+    }
+    assert(counts[4] == 0);
+    assert(counts[5] > 5700 && counts[5] < 6300);
+    assert(counts[0] > 800 && counts[0] < 1200);
+
+    // Copies keep the weights, and moving into a non-empty belief state
+    // mixes weighted and unweighted samples
+    BELIEF_STATE copy, mixed;
+    copy.Copy(beliefs, simulator);
+    assert(copy.GetNumSamples() == 6 && copy.GetWeight(5) == 6);
+    TEST_STATE* plain = new TEST_STATE;
+    plain->Depth = 6;
+    mixed.AddSample(plain);
+    mixed.Move(copy);
+    assert(copy.Empty() && !copy.Weighted());
+    assert(mixed.GetNumSamples() == 7 && mixed.GetTotalWeight() == 11);
+    assert(mixed.GetWeight(0) == 1 && mixed.GetWeight(6) == 6);
+    mixed.Free(simulator);
+
+    // Systematic resampling draws each sample in proportion to its weight,
+    // to within one
+    beliefs.Resample(20, simulator);
+    assert(beliefs.GetNumSamples() == 20 && !beliefs.Weighted());
+    int resampled[6] = { 0 };
+    for (int i = 0; i < 20; i++)
+        resampled[safe_cast<const TEST_STATE*>(beliefs.GetSample(i))->Depth]++;
+    assert(resampled[4] == 0);
+    assert(resampled[5] >= 11 && resampled[5] <= 13);
+    for (int depth = 0; depth < 4; depth++)
+        assert(resampled[depth] >= 1 && resampled[depth] <= 3);
+
+    std::vector<STATE*> samples;
+    std::vector<double> weights;
+    beliefs.Release(samples, weights);
+    assert(beliefs.Empty() && samples.size() == 20 && weights[0] == 1);
+    for (int i = 0; i < (int) samples.size(); i++)
+        simulator.FreeState(samples[i]);
 }
@@ -6,6 +6,9 @@
 class STATE;
 class SIMULATOR;
 
+// Particles, each with an importance weight. Samples added without a weight
+// weigh 1, and a belief state holding only those keeps no weights at all, so
+// the particles gathered during search cost nothing extra.
 class BELIEF_STATE
 {
 public:
@@ -15,11 +18,13 @@ public:
     // Free memory for all states
     void Free(const SIMULATOR& simulator);
 
-    // Creates new state, now owned by caller
+    // Creates new state, now owned by caller, drawn in proportion to the
+    // weights
     STATE* CreateSample(const SIMULATOR& simulator) const;
 
     // Added state is owned by belief state
     void AddSample(STATE* state);
+    void AddSample(STATE* state, double weight);
 
     // Make own copies of all samples
     void Copy(const BELIEF_STATE& beliefs, const SIMULATOR& simulator);
@@ -27,13 +32,37 @@ public:
     // Move all samples into this belief state
     void Move(BELIEF_STATE& beliefs);
 
+    // Hand all samples and their weights to the caller, leaving this empty
+    void Release(std::vector<STATE*>& samples, std::vector<double>& weights);
+
+    // Replace the samples by numSamples of equal weight, chosen by
+    // systematic resampling. Each sample chosen is kept, and only further
+    // draws of the same sample are copied.
+    void Resample(int numSamples, const SIMULATOR& simulator);
+
     bool Empty() const { return Samples.empty(); }
     int GetNumSamples() const { return Samples.size(); }
     const STATE* GetSample(int index) const { return Samples[index]; }
-    
+    bool Weighted() const { return !Cumulative.empty(); }
+    double GetWeight(int index) const;
+    double GetTotalWeight() const;
+    // Kish's effective sample size, (sum w)^2 / sum w^2, which is the number
+    // of samples when they weigh the same
+    double GetEffectiveSampleSize() const;
+
+    static void UnitTest();
+
 private:
 
+    // Total weight of samples up to index
+    double GetCumulative(int index) const
+    {
+        return Cumulative.empty() ? index + 1 : Cumulative[index];
+    }
+
     std::vector<STATE*> Samples;
+    // Running total of the weights, empty while every sample weighs 1
+    std::vector<double> Cumulative;
 };
 
 #endif // BELIEF_STATE_H
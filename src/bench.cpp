@@ -0,0 +1,44 @@
+#include "bench.h"
+#include <algorithm>
+#include <iomanip>
+
+using namespace std;
+
+BENCHMARK::PARAMS::PARAMS()
+:   Samples(7),
+    WarmupTime(0.2),
+    SampleTime(0.2),
+    Seed(1)
+{
+}
+
+BENCHMARK::BENCHMARK(const PARAMS& params, ostream& ostr)
+:   Params(params),
+    Output(ostr)
+{
+    Output << left << setw(40) << "Benchmark" << right
+        << setw(14) << "Median" << setw(14) << "Min"
+        << setw(10) << "Spread" << setw(16) << "Items/s" << endl;
+}
+
+bool BENCHMARK::Selected(const string& name) const
+{
+    return name.find(Params.Filter) != string::npos;
+}
+
+void BENCHMARK::Report(const string& name, vector<double>& itemTimes)
+{
+    sort(itemTimes.begin(), itemTimes.end());
+    double median = itemTimes[itemTimes.size() / 2];
+    if (itemTimes.size() % 2 == 0)
+        median = (median + itemTimes[itemTimes.size() / 2 - 1]) / 2;
+
+    // Spread is the interquartile range relative to the median
+    double spread = itemTimes[itemTimes.size() * 3 / 4] - itemTimes[itemTimes.size() / 4];
+    Output << left << setw(40) << name << right << fixed
+        << setw(11) << setprecision(1) << median * 1e9 << " ns"
+        << setw(11) << setprecision(1) << itemTimes.front() * 1e9 << " ns"
+        << setw(9) << setprecision(1) << 100 * spread / median << "%"
+        << setw(16) << setprecision(0) << 1 / median << endl;
+    Output.unsetf(ios::floatfield);
+}
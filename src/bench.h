@@ -0,0 +1,111 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "timer.h"
+#include "utils.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+//----------------------------------------------------------------------------
+// Microbenchmark harness. Each benchmark is warmed up, then timed over
+// several samples, each reseeded with the same random stream, and reported
+// as the median time per item with the spread of the samples, so that runs
+// of the same build on the same machine can be compared.
+
+class BENCHMARK
+{
+public:
+
+    struct PARAMS
+    {
+        PARAMS();
+
+        int Samples;
+        double WarmupTime;      // seconds
+        double SampleTime;      // minimum seconds per sample
+        uint64_t Seed;
+        std::string Filter;     // run only benchmarks whose names contain it
+    };
+
+    BENCHMARK(const PARAMS& params, std::ostream& ostr);
+
+    bool Selected(const std::string& name) const;
+
+    // Time body, which processes itemsPerCall items per call, calling it as
+    // often as it takes to fill each sample
+    template<class BODY>
+    void Run(const std::string& name, int itemsPerCall, BODY body);
+
+    // Time single calls of body, each after an untimed call of setup
+    template<class SETUP, class BODY>
+    void Run(const std::string& name, int itemsPerCall, SETUP setup, BODY body);
+
+private:
+
+    void Report(const std::string& name, std::vector<double>& itemTimes);
+
+    PARAMS Params;
+    std::ostream& Output;
+};
+
+template<class BODY>
+void BENCHMARK::Run(const std::string& name, int itemsPerCall, BODY body)
+{
+    if (!Selected(name))
+        return;
+
+    // The warmup also finds how many calls fill a sample
+    UTILS::RandomSeed(Params.Seed);
+    TIMER timer;
+    long calls = 0;
+    do
+    {
+        body();
+        calls++;
+    }
+    while (timer.Elapsed() < Params.WarmupTime);
+    long callsPerSample = (long) (calls * Params.SampleTime / timer.Elapsed()) + 1;
+
+    std::vector<double> itemTimes;
+    for (int sample = 0; sample < Params.Samples; sample++)
+    {
+        UTILS::RandomSeed(Params.Seed, sample + 1);
+        timer.Restart();
+        for (long call = 0; call < callsPerSample; call++)
+            body();
+        itemTimes.push_back(timer.Elapsed() / (callsPerSample * itemsPerCall));
+    }
+    Report(name, itemTimes);
+}
+
+template<class SETUP, class BODY>
+void BENCHMARK::Run(const std::string& name, int itemsPerCall, SETUP setup, BODY body)
+{
+    if (!Selected(name))
+        return;
+
+    UTILS::RandomSeed(Params.Seed);
+    TIMER timer;
+    do
+    {
+        setup();
+        body();
+    }
+    while (timer.Elapsed() < Params.WarmupTime);
+
+    std::vector<double> itemTimes;
+    for (int sample = 0; sample < Params.Samples; sample++)
+    {
+        UTILS::RandomSeed(Params.Seed, sample + 1);
+        setup();
+        timer.Restart();
+        body();
+        itemTimes.push_back(timer.Elapsed() / itemsPerCall);
+    }
+    Report(name, itemTimes);
+}
+
+//----------------------------------------------------------------------------
+
+#endif // BENCH_H
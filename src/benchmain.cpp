@@ -0,0 +1,115 @@
+#include "bench.h"
+#include "beliefstate.h"
+#include "mcts.h"
+#include "rocksample.h"
+#include <boost/program_options.hpp>
+#include <memory>
+#include <sstream>
+
+using namespace std;
+using namespace boost::program_options;
+using namespace UTILS;
+
+// Benchmarks of the simulator and the search on one rocksample layout
+void BenchmarkRocksample(BENCHMARK& bench, int size, int rocks,
+    int minDoubles, int maxDoubles)
+{
+    ROCKSAMPLE rocksample(size, rocks);
+    ostringstream prefix;
+    prefix << "rocksample_" << size << "_" << rocks << "/";
+
+    SIMULATOR::STATUS status;
+    HISTORY history;
+    STATE* state = rocksample.CreateStartState();
+    bench.Run(prefix.str() + "step", 1, [&]()
+    {
+        int observation;
+        RC rewardcost;
+        int action = rocksample.SelectRandom(*state, history, status);
+        if (rocksample.Step(*state, action, observation, rewardcost))
+        {
+            rocksample.FreeState(state);
+            state = rocksample.CreateStartState();
+        }
+    });
+
+    bench.Run(prefix.str() + "copy_free", 1, [&]()
+    {
+        rocksample.FreeState(rocksample.Copy(*state));
+    });
+    rocksample.FreeState(state);
+
+    BELIEF_STATE beliefs;
+    for (int i = 0; i < 1024; i++)
+        beliefs.AddSample(rocksample.CreateStartState());
+    bench.Run(prefix.str() + "create_sample", 1, [&]()
+    {
+        rocksample.FreeState(beliefs.CreateSample(rocksample));
+    });
+    beliefs.Free(rocksample);
+
+    MCTS::PARAMS params;
+    params.NumStartStates = 1;
+    params.MaxDepth = rocksample.GetHorizon(0.01, 1000);
+    params.c_hat = Infinity;
+    MCTS rollouts(rocksample, params);
+    STATE* start = rocksample.CreateStartState();
+    bench.Run(prefix.str() + "rollout", 1, [&]()
+    {
+        STATE* rollout = rocksample.Copy(*start);
+        rollouts.Rollout(*rollout);
+        rocksample.FreeState(rollout);
+    });
+    rocksample.FreeState(start);
+
+    // Whole searches, timed per simulation, with the settings of
+    // EXPERIMENT::DiscountedReturn
+    params.ExplorationConstant = rocksample.GetRewardRange();
+    for (int doubles = minDoubles; doubles <= maxDoubles; doubles++)
+    {
+        ostringstream name;
+        name << prefix.str() << "uct_search/2^" << doubles;
+        params.NumSimulations = 1 << doubles;
+        params.NumStartStates = 1 << doubles;
+        unique_ptr<MCTS> mcts;
+        bench.Run(name.str(), params.NumSimulations,
+            [&]() { mcts.reset(new MCTS(rocksample, params)); },
+            [&]() { mcts->SelectAction(); });
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    BENCHMARK::PARAMS benchParams;
+    int minDoubles, maxDoubles;
+
+    options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "produce help message")
+        ("samples", value<int>(&benchParams.Samples), "timed samples of each benchmark")
+        ("warmup", value<double>(&benchParams.WarmupTime), "seconds of warmup before each benchmark")
+        ("sampletime", value<double>(&benchParams.SampleTime), "minimum seconds per sample")
+        ("seed", value<uint64_t>(&benchParams.Seed), "random seed (sample n uses the n-th stream of this seed)")
+        ("filter", value<string>(&benchParams.Filter), "run only benchmarks whose names contain this")
+        ("mindoubles", value<int>(&minDoubles)->default_value(10), "minimum power of two simulations of the searches")
+        ("maxdoubles", value<int>(&maxDoubles)->default_value(16), "maximum power of two simulations of the searches")
+        ;
+
+    variables_map vm;
+    store(parse_command_line(argc, argv, desc), vm);
+    notify(vm);
+
+    if (vm.count("help"))
+    {
+        cout << desc << "\n";
+        return 1;
+    }
+
+    BENCHMARK bench(benchParams, cout);
+    BenchmarkRocksample(bench, 5, 5, minDoubles, maxDoubles);
+    BenchmarkRocksample(bench, 5, 7, minDoubles, maxDoubles);
+    BenchmarkRocksample(bench, 7, 8, minDoubles, maxDoubles);
+    BenchmarkRocksample(bench, 11, 11, minDoubles, maxDoubles);
+    MCTS::Benchmark(bench);
+    return 0;
+}
@@ -1,7 +1,11 @@
 #include "experiment.h"
-#include "boost/timer.hpp"
+#include "timer.h"
+#include <mutex>
+#include <sstream>
+#include <thread>
 
 using namespace std;
+using namespace UTILS;
 
 EXPERIMENT::PARAMS::PARAMS()
 :   NumRuns(1000),
@@ -14,7 +18,9 @@ EXPERIMENT::PARAMS::PARAMS()
     TransformAttempts(1000),
     Accuracy(0.01),
     UndiscountedHorizon(1000),
-    AutoExploration(true)
+    AutoExploration(true),
+    Seed(0),
+    NumRunThreads(1)
 {
 }
 
@@ -23,10 +29,13 @@ EXPERIMENT::EXPERIMENT(const SIMULATOR& real,
     EXPERIMENT::PARAMS& expParams, MCTS::PARAMS& searchParams)
 :   Real(real),
     Simulator(simulator),
-    OutputFile(outputFile.c_str()),
     ExpParams(expParams),
     SearchParams(searchParams)
 {
+    if (!outputFile.empty())
+        OutputFile.open(outputFile.c_str());
+    if (!ExpParams.ProfileFile.empty())
+        ProfileFile.open(ExpParams.ProfileFile.c_str());
     if (ExpParams.AutoExploration)
     {
         if (SearchParams.UseRave)
@@ -34,12 +43,11 @@ EXPERIMENT::EXPERIMENT(const SIMULATOR& real,
         else
             SearchParams.ExplorationConstant = simulator.GetRewardRange();
     }
-    MCTS::InitFastUCB(SearchParams.ExplorationConstant);
 }
 
-void EXPERIMENT::Run()
+void EXPERIMENT::Run(RESULTS& results, ostream& ostr, int run)
 {
-    boost::timer timer;
+    TIMER timer;
 
     MCTS mcts(Simulator, SearchParams);
 
@@ -52,18 +60,22 @@ void EXPERIMENT::Run()
 
     STATE* state = Real.CreateStartState();
     if (SearchParams.Verbose >= 1)
-        Real.DisplayState(*state, cout);
+        Real.DisplayState(*state, ostr);
 
     for (t = 0; t < ExpParams.NumSteps; t++)
     {
         int observation;
         RC rewardcost;
+        TIMER decisionTimer;
         Policy policy = mcts.SelectAction();
+        double decisionTime = decisionTimer.Elapsed();
+        results.Simulations.Add(mcts.GetSimulationsRun());
         int action = policy.sampleAction();
+        mcts.StartPondering(action);
         terminal = Real.Step(*state, action, observation, rewardcost);
 
-        Results.Reward.Add(rewardcost.R);
-        Results.Cost.Add(rewardcost.C);
+        results.Reward.Add(rewardcost.R);
+        results.Cost.Add(rewardcost.C);
         undiscountedReturn += rewardcost;
         discountedReturn += rewardcost * discount;
         discount *= Real.GetDiscount();
@@ -74,32 +86,37 @@ void EXPERIMENT::Run()
 
         if (SearchParams.Verbose >= 1)
         {
-            Real.DisplayAction(action, cout);
-            Real.DisplayState(*state, cout);
-            Real.DisplayObservation(*state, observation, cout);
-            Real.DisplayRewardCost(rewardcost, cout);
+            Real.DisplayAction(action, ostr);
+            Real.DisplayState(*state, ostr);
+            Real.DisplayObservation(*state, observation, ostr);
+            Real.DisplayRewardCost(rewardcost, ostr);
         }
 
         if (terminal)
         {
-            cout << "Terminated" << endl;
+            results.DecisionLatency.Add(decisionTime);
+            ostr << "Terminated" << endl;
+            WriteProfile(mcts, run, t);
             break;
         }
+        decisionTimer.Restart();
         outOfParticles = !mcts.Update(action, observation, rewardcost);
+        results.DecisionLatency.Add(decisionTime + decisionTimer.Elapsed());
+        WriteProfile(mcts, run, t);
         if (outOfParticles)
             break;
 
-        if (timer.elapsed() > ExpParams.TimeOut)
+        if (timer.Elapsed() > ExpParams.TimeOut)
         {
-            cout << "Timed out after " << t << " steps in "
-                << Results.Time.GetTotal() << "seconds" << endl;
+            ostr << "Timed out after " << t << " steps in "
+                << timer.Elapsed() << "seconds" << endl;
             break;
         }
     }
 
     if (outOfParticles)
     {
-        cout << "Out of particles, finishing episode with SelectRandom" << endl;
+        ostr << "Out of particles, finishing episode with SelectRandom" << endl;
         HISTORY history = mcts.GetHistory();
         while (++t < ExpParams.NumSteps)
         {
@@ -112,23 +129,23 @@ void EXPERIMENT::Run()
             int action = Simulator.SelectRandom(*state, history, mcts.GetStatus());
             terminal = Real.Step(*state, action, observation, rewardcost);
 
-            Results.Reward.Add(rewardcost.R);
-            Results.Cost.Add(rewardcost.C);
+            results.Reward.Add(rewardcost.R);
+            results.Cost.Add(rewardcost.C);
             undiscountedReturn += rewardcost;
             discountedReturn += rewardcost * discount;
             discount *= Real.GetDiscount();
 
             if (SearchParams.Verbose >= 1)
             {
-                Real.DisplayAction(action, cout);
-                Real.DisplayState(*state, cout);
-                Real.DisplayObservation(*state, observation, cout);
-                Real.DisplayRewardCost(rewardcost, cout);
+                Real.DisplayAction(action, ostr);
+                Real.DisplayState(*state, ostr);
+                Real.DisplayObservation(*state, observation, ostr);
+                Real.DisplayRewardCost(rewardcost, ostr);
             }
 
             if (terminal)
             {
-                cout << "Terminated" << endl;
+                ostr << "Terminated" << endl;
                 break;
             }
 
@@ -136,36 +153,71 @@ void EXPERIMENT::Run()
         }
     }
 
-    Results.Time.Add(timer.elapsed());
-    Results.OneStepTime.Add(timer.elapsed() / t);
-    Results.TimeSteps.Add(t);
-    Results.UndiscountedRewardReturn.Add(undiscountedReturn.R);
-    Results.UndiscountedCostReturn.Add(undiscountedReturn.C);
-    Results.DiscountedRewardReturn.Add(discountedReturn.R);
-    Results.DiscountedCostReturn.Add(discountedReturn.C);
-    cout << "==============================" << endl;
-    cout << "Discounted reward return = " << discountedReturn.R
+    results.Time.Add(timer.Elapsed());
+    results.OneStepTime.Add(timer.Elapsed() / t);
+    results.TimeSteps.Add(t);
+    results.UndiscountedRewardReturn.Add(undiscountedReturn.R);
+    results.UndiscountedCostReturn.Add(undiscountedReturn.C);
+    results.DiscountedRewardReturn.Add(discountedReturn.R);
+    results.DiscountedCostReturn.Add(discountedReturn.C);
+    results.Lambda.Add(mcts.getLambda());
+    results.Nodes.Add(mcts.GetNodesExpanded());
+}
+
+void EXPERIMENT::DisplayRun(const RESULTS& run, ostream& ostr) const
+{
+    ostr << "==============================" << endl;
+    ostr << "Discounted reward return = " << run.DiscountedRewardReturn.GetMean()
         << ", average = " << Results.DiscountedRewardReturn.GetMean() << endl;
-    cout << "Discounted cost return = " << discountedReturn.C
+    ostr << "Discounted cost return = " << run.DiscountedCostReturn.GetMean()
         << ", average = " << Results.DiscountedCostReturn.GetMean() << endl;
 
-    cout << "Undiscounted reward return = " << undiscountedReturn.R
+    ostr << "Undiscounted reward return = " << run.UndiscountedRewardReturn.GetMean()
         << ", average = " << Results.UndiscountedRewardReturn.GetMean() << endl;
-    cout << "Undiscounted cost return = " << undiscountedReturn.C
+    ostr << "Undiscounted cost return = " << run.UndiscountedCostReturn.GetMean()
         << ", average = " << Results.UndiscountedCostReturn.GetMean() << endl;
-    cout << "Lambda = " << mcts.getLambda() << endl;
-    cout << "NumSteps = " << t << endl;
-    cout << "Time per steps = " << timer.elapsed() / t << endl;
-    cout << "==============================" << endl;
+    ostr << "Lambda = " << run.Lambda.GetMean() << endl;
+    ostr << "NumSteps = " << run.TimeSteps.GetMean() << endl;
+    ostr << "Time per steps = " << run.OneStepTime.GetMean() << endl;
+    if (SearchParams.TimeBudget > 0 || SearchParams.StopInterval > 0)
+        ostr << "Simulations per step = " << run.Simulations.GetMean() << endl;
+    ostr << "==============================" << endl;
+}
+
+// One JSON line of the search phases of a real step, from SelectAction
+// to the end of Update
+void EXPERIMENT::WriteProfile(MCTS& mcts, int run, int step)
+{
+    if (!ProfileFile.is_open())
+        return;
+    ostringstream line;
+    line << "{\"simulations\":" << SearchParams.NumSimulations
+        << ",\"run\":" << run << ",\"step\":" << step << ",";
+    mcts.GetProfile().Write(line);
+    line << "}\n";
+    mcts.ClearProfile();
+
+    lock_guard<mutex> lock(ProfileMutex);
+    ProfileFile << line.str() << flush;
 }
 
 void EXPERIMENT::MultiRun()
 {
+    if (ExpParams.NumRunThreads > 1)
+    {
+        ParallelMultiRun();
+        return;
+    }
+
     for (int n = 0; n < ExpParams.NumRuns; n++)
     {
         cout << "Starting run " << n + 1 << " with "
             << SearchParams.NumSimulations << " simulations... " << endl;
-        Run();
+        RandomSeed(ExpParams.Seed, n);
+        RESULTS run;
+        Run(run, cout, n);
+        Results.Merge(run);
+        DisplayRun(run, cout);
         if (Results.Time.GetTotal() > ExpParams.TimeOut)
         {
             cout << "Timed out after " << n << " runs in "
@@ -175,6 +227,78 @@ void EXPERIMENT::MultiRun()
     }
 }
 
+void EXPERIMENT::ParallelMultiRun()
+{
+    // Episodes are independent, so a pool of threads runs them concurrently.
+    // Results and logs are committed in run order, which reproduces the
+    // output of a sequential MultiRun with the same seed.
+    vector<RESULTS> runs(ExpParams.NumRuns);
+    vector<string> logs(ExpParams.NumRuns);
+    vector<bool> done(ExpParams.NumRuns, false);
+    int next = 0, committed = 0;
+    bool timedOut = false;
+    mutex runMutex;
+
+    vector<thread> threads;
+    for (int i = 0; i < ExpParams.NumRunThreads; i++)
+    {
+        threads.push_back(thread([&]()
+        {
+            while (true)
+            {
+                int n;
+                {
+                    lock_guard<mutex> lock(runMutex);
+                    if (timedOut || next >= ExpParams.NumRuns)
+                        return;
+                    n = next++;
+                }
+
+                ostringstream log;
+                log << "Starting run " << n + 1 << " with "
+                    << SearchParams.NumSimulations << " simulations... " << endl;
+                RandomSeed(ExpParams.Seed, n);
+                Run(runs[n], log, n);
+
+                lock_guard<mutex> lock(runMutex);
+                logs[n] = log.str();
+                done[n] = true;
+                while (!timedOut && committed < ExpParams.NumRuns && done[committed])
+                {
+                    cout << logs[committed];
+                    Results.Merge(runs[committed]);
+                    DisplayRun(runs[committed], cout);
+                    if (Results.Time.GetTotal() > ExpParams.TimeOut)
+                    {
+                        cout << "Timed out after " << committed << " runs in "
+                            << Results.Time.GetTotal() << "seconds" << endl;
+                        timedOut = true;
+                    }
+                    committed++;
+                }
+            }
+        }));
+    }
+
+    for (int i = 0; i < (int) threads.size(); i++)
+        threads[i].join();
+}
+
+void EXPERIMENT::SetSimulations(int doubles)
+{
+    SearchParams.MaxDepth = Simulator.GetHorizon(ExpParams.Accuracy, ExpParams.UndiscountedHorizon);
+    ExpParams.SimSteps = Simulator.GetHorizon(ExpParams.Accuracy, ExpParams.UndiscountedHorizon);
+    ExpParams.NumSteps = Real.GetHorizon(ExpParams.Accuracy, ExpParams.UndiscountedHorizon);
+
+    SearchParams.NumSimulations = 1 << doubles;
+    SearchParams.NumStartStates = 1 << doubles;
+    if (doubles + ExpParams.TransformDoubles >= 0)
+        SearchParams.NumTransforms = 1 << (doubles + ExpParams.TransformDoubles);
+    else
+        SearchParams.NumTransforms = 1;
+    SearchParams.MaxAttempts = SearchParams.NumTransforms * ExpParams.TransformAttempts;
+}
+
 void EXPERIMENT::DiscountedReturn()
 {
     cout << "Main runs" << endl;
@@ -190,22 +314,16 @@ void EXPERIMENT::DiscountedReturn()
             << "Discounted cost return" << "\t"
             << "Discounted cost error" << "\t"
             << "Time" << "\t"
-            << "TimePerStep" << "\n";
-
-    SearchParams.MaxDepth = Simulator.GetHorizon(ExpParams.Accuracy, ExpParams.UndiscountedHorizon);
-    ExpParams.SimSteps = Simulator.GetHorizon(ExpParams.Accuracy, ExpParams.UndiscountedHorizon);
-    ExpParams.NumSteps = Real.GetHorizon(ExpParams.Accuracy, ExpParams.UndiscountedHorizon);
+            << "TimePerStep" << "\t"
+            << "LatencyP50" << "\t"
+            << "LatencyP90" << "\t"
+            << "LatencyP99" << "\t"
+            << "LatencyMax" << "\t"
+            << "LatencyHistogram" << "\n";
 
     for (int i = ExpParams.MinDoubles; i <= ExpParams.MaxDoubles; i++)
     {
-        SearchParams.NumSimulations = 1 << i;
-        SearchParams.NumStartStates = 1 << i;
-        if (i + ExpParams.TransformDoubles >= 0)
-            SearchParams.NumTransforms = 1 << (i + ExpParams.TransformDoubles);
-        else
-            SearchParams.NumTransforms = 1;
-        SearchParams.MaxAttempts = SearchParams.NumTransforms * ExpParams.TransformAttempts;
-
+        SetSimulations(i);
         Results.Clear();
         MultiRun();
 
@@ -221,7 +339,14 @@ void EXPERIMENT::DiscountedReturn()
             << "Discounted cost return = " << Results.DiscountedCostReturn.GetMean()
             << " +- " << Results.DiscountedCostReturn.GetStdErr() << endl
             << "Time = " << Results.Time.GetMean() << endl
-            << "Time per time step = " << Results.OneStepTime.GetMean() << endl;
+            << "Time per time step = " << Results.OneStepTime.GetMean() << endl
+            << "Decision latency p50 = " << Results.DecisionLatency.GetPercentile(0.5)
+            << ", p90 = " << Results.DecisionLatency.GetPercentile(0.9)
+            << ", p99 = " << Results.DecisionLatency.GetPercentile(0.99)
+            << ", max = " << Results.DecisionLatency.GetMax() << endl;
+        if (SearchParams.TimeBudget > 0 || SearchParams.StopInterval > 0)
+            cout << "Simulations per step = " << Results.Simulations.GetMean()
+                << " +- " << Results.Simulations.GetStdErr() << endl;
         cout << "=============================" << endl;
         OutputFile << SearchParams.NumSimulations << "\t"
             << Results.TimeSteps.GetMean() << "\t"
@@ -235,7 +360,13 @@ void EXPERIMENT::DiscountedReturn()
             << Results.DiscountedCostReturn.GetMean() << "\t"
             << Results.DiscountedCostReturn.GetStdErr() << "\t"
             << Results.Time.GetMean() << "\t"
-            << Results.OneStepTime.GetMean() << endl;
+            << Results.OneStepTime.GetMean() << "\t"
+            << Results.DecisionLatency.GetPercentile(0.5) << "\t"
+            << Results.DecisionLatency.GetPercentile(0.9) << "\t"
+            << Results.DecisionLatency.GetPercentile(0.99) << "\t"
+            << Results.DecisionLatency.GetMax() << "\t";
+        Results.DecisionLatency.WriteHistogram(OutputFile);
+        OutputFile << endl;
     }
 }
 
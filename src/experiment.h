@@ -1,16 +1,19 @@
 #ifndef EXPERIMENT_H
 #define EXPERIMENT_H
 
+#include "latency.h"
 #include "mcts.h"
 #include "simulator.h"
 #include "statistic.h"
 #include <fstream>
+#include <mutex>
 
 //----------------------------------------------------------------------------
 
 struct RESULTS
 {
     void Clear();
+    void Merge(const RESULTS& results);
 
     STATISTIC Time;
     STATISTIC OneStepTime;
@@ -21,6 +24,11 @@ struct RESULTS
     STATISTIC DiscountedCostReturn;
     STATISTIC UndiscountedRewardReturn;
     STATISTIC UndiscountedCostReturn;
+    STATISTIC Lambda;
+    STATISTIC Simulations;
+    STATISTIC Nodes;
+    // Wall-clock time of each SelectAction and the Update that follows it
+    LATENCY DecisionLatency;
 };
 
 inline void RESULTS::Clear()
@@ -34,6 +42,27 @@ inline void RESULTS::Clear()
     DiscountedCostReturn.Clear();
     UndiscountedRewardReturn.Clear();
     UndiscountedCostReturn.Clear();
+    Lambda.Clear();
+    Simulations.Clear();
+    Nodes.Clear();
+    DecisionLatency.Clear();
+}
+
+inline void RESULTS::Merge(const RESULTS& results)
+{
+    Time.Merge(results.Time);
+    OneStepTime.Merge(results.OneStepTime);
+    TimeSteps.Merge(results.TimeSteps);
+    Reward.Merge(results.Reward);
+    Cost.Merge(results.Cost);
+    DiscountedRewardReturn.Merge(results.DiscountedRewardReturn);
+    DiscountedCostReturn.Merge(results.DiscountedCostReturn);
+    UndiscountedRewardReturn.Merge(results.UndiscountedRewardReturn);
+    UndiscountedCostReturn.Merge(results.UndiscountedCostReturn);
+    Lambda.Merge(results.Lambda);
+    Simulations.Merge(results.Simulations);
+    Nodes.Merge(results.Nodes);
+    DecisionLatency.Merge(results.DecisionLatency);
 }
 
 //----------------------------------------------------------------------------
@@ -56,18 +85,31 @@ public:
         double Accuracy;
         int UndiscountedHorizon;
         bool AutoExploration;
+        uint64_t Seed;
+        int NumRunThreads;
+        // JSON lines of search phase timings per real step, if not empty
+        std::string ProfileFile;
     };
 
+    // An empty outputFile writes no summary
     EXPERIMENT(const SIMULATOR& real, const SIMULATOR& simulator, 
         const std::string& outputFile, 
         EXPERIMENT::PARAMS& expParams, MCTS::PARAMS& searchParams);
 
-    void Run();
+    // Search with 2^doubles simulations, to the depth and for the number of
+    // steps that DiscountedReturn uses
+    void SetSimulations(int doubles);
+
+    void Run(RESULTS& results, std::ostream& ostr, int run = 0);
     void MultiRun();
     void DiscountedReturn();
 
 private:
 
+    void ParallelMultiRun();
+    void DisplayRun(const RESULTS& run, std::ostream& ostr) const;
+    void WriteProfile(MCTS& mcts, int run, int step);
+
     const SIMULATOR& Real;
     const SIMULATOR& Simulator;
     EXPERIMENT::PARAMS& ExpParams;
@@ -75,6 +117,8 @@ private:
     RESULTS Results;
 
     std::ofstream OutputFile;
+    std::ofstream ProfileFile;
+    std::mutex ProfileMutex;
 };
 
 //----------------------------------------------------------------------------
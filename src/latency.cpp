@@ -0,0 +1,120 @@
+#include "latency.h"
+#include <assert.h>
+#include <math.h>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+static const double MinLatency = 1e-6;
+
+void LATENCY::Add(double seconds)
+{
+    int bucket = 0;
+    if (seconds > MinLatency)
+    {
+        bucket = (int) ceil(log2(seconds / MinLatency) * BucketsPerOctave) - 1;
+        if (bucket < 0)
+            bucket = 0;
+        if (bucket >= NumBuckets)
+            bucket = NumBuckets - 1;
+    }
+    Counts[bucket]++;
+    Count++;
+    if (seconds > Max)
+        Max = seconds;
+}
+
+void LATENCY::Merge(const LATENCY& latency)
+{
+    for (int bucket = 0; bucket < NumBuckets; bucket++)
+        Counts[bucket] += latency.Counts[bucket];
+    Count += latency.Count;
+    if (latency.Max > Max)
+        Max = latency.Max;
+}
+
+void LATENCY::Clear()
+{
+    for (int bucket = 0; bucket < NumBuckets; bucket++)
+        Counts[bucket] = 0;
+    Count = 0;
+    Max = 0;
+}
+
+double LATENCY::GetPercentile(double p) const
+{
+    if (Count == 0)
+        return 0;
+    int64_t rank = (int64_t) ceil(p * Count);
+    if (rank < 1)
+        rank = 1;
+    int64_t seen = 0;
+    for (int bucket = 0; bucket < NumBuckets; bucket++)
+    {
+        seen += Counts[bucket];
+        // The last bucket also holds everything beyond the range
+        if (seen >= rank)
+            return bucket < NumBuckets - 1 && UpperBound(bucket) < Max ? UpperBound(bucket) : Max;
+    }
+    return Max;
+}
+
+void LATENCY::WriteHistogram(ostream& ostr) const
+{
+    bool first = true;
+    for (int bucket = 0; bucket < NumBuckets; bucket++)
+    {
+        if (Counts[bucket] == 0)
+            continue;
+        if (!first)
+            ostr << ",";
+        ostr << UpperBound(bucket) * 1e6 << ":" << Counts[bucket];
+        first = false;
+    }
+}
+
+double LATENCY::UpperBound(int bucket)
+{
+    return MinLatency * exp2((bucket + 1) / (double) BucketsPerOctave);
+}
+
+//----------------------------------------------------------------------------
+
+void LATENCY::UnitTest()
+{
+    LATENCY latency, other;
+    assert(latency.GetCount() == 0 && latency.GetPercentile(0.5) == 0);
+
+    // 1ms to 100ms in 1ms steps
+    for (int i = 1; i <= 100; i++)
+        (i % 2 ? latency : other).Add(i * 1e-3);
+    latency.Merge(other);
+    assert(latency.GetCount() == 100);
+    assert(latency.GetMax() == 0.1);
+    double p50 = latency.GetPercentile(0.5);
+    double p90 = latency.GetPercentile(0.9);
+    double p99 = latency.GetPercentile(0.99);
+    assert(p50 >= 0.050 && p50 <= 0.050 * 1.045);
+    assert(p90 >= 0.090 && p90 <= 0.090 * 1.045);
+    assert(p99 >= 0.099 && p99 <= 0.1);
+    assert(latency.GetPercentile(1) == 0.1);
+
+    // Out of range latencies go to the end buckets
+    LATENCY extremes;
+    extremes.Add(0);
+    extremes.Add(1e6);
+    assert(extremes.GetPercentile(0.5) <= 1.1e-6);
+    assert(extremes.GetPercentile(1) == 1e6);
+
+    ostringstream histogram;
+    extremes.WriteHistogram(histogram);
+    string text = histogram.str();
+    assert(text.compare(0, 9, "1.04427:1") == 0);
+    assert(text.find(',') != string::npos);
+
+    latency.Clear();
+    assert(latency.GetCount() == 0 && latency.GetMax() == 0);
+}
+
+//----------------------------------------------------------------------------
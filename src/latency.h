@@ -0,0 +1,47 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <iostream>
+#include <stdint.h>
+
+//----------------------------------------------------------------------------
+// Histogram of latencies, in buckets spaced logarithmically from one
+// microsecond to about 1000 seconds, BucketsPerOctave to each doubling.
+// Percentiles are the upper bound of the bucket they fall in, so are at most
+// 1/BucketsPerOctave of an octave (4.4%) high, except the exact maximum.
+
+class LATENCY
+{
+public:
+
+    LATENCY() { Clear(); }
+
+    void Add(double seconds);
+    void Merge(const LATENCY& latency);
+    void Clear();
+
+    int64_t GetCount() const { return Count; }
+    double GetMax() const { return Max; }
+    // Latency in seconds that fraction p of the samples do not exceed
+    double GetPercentile(double p) const;
+
+    // Non-empty buckets as upper bound in microseconds and count,
+    // "<upper>:<count>,..."
+    void WriteHistogram(std::ostream& ostr) const;
+
+    static void UnitTest();
+
+private:
+
+    static const int BucketsPerOctave = 16;
+    static const int NumBuckets = 30 * BucketsPerOctave;
+    static double UpperBound(int bucket);
+
+    int64_t Counts[NumBuckets];
+    int64_t Count;
+    double Max;
+};
+
+//----------------------------------------------------------------------------
+
+#endif // LATENCY_H
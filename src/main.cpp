@@ -1,6 +1,10 @@
+#include "beliefstate.h"
 #include "mcts.h"
 #include "rocksample.h"
 #include "experiment.h"
+#include "regression.h"
+#include "selection.h"
+#include "server.h"
 #include <boost/program_options.hpp>
 
 using namespace std;
@@ -12,8 +16,24 @@ void UnitTests()
     UTILS::UnitTest();
     cout << "Testing COORD" << endl;
     COORD::UnitTest();
+    cout << "Testing SELECTION" << endl;
+    SELECTION::UnitTest();
+    cout << "Testing PROFILE" << endl;
+    PROFILE::UnitTest();
+    cout << "Testing REGRESSION" << endl;
+    REGRESSION::UnitTest();
+    cout << "Testing LATENCY" << endl;
+    LATENCY::UnitTest();
+    cout << "Testing BELIEF_STATE" << endl;
+    BELIEF_STATE::UnitTest();
+    // The searches come last, so that a failing search cannot hide the
+    // results of the suites that do not depend on it
     cout << "Testing MCTS" << endl;
     MCTS::UnitTest();
+    cout << "Testing ROCKSAMPLE" << endl;
+    ROCKSAMPLE::UnitTest();
+    cout << "Testing SERVER" << endl;
+    SERVER::UnitTest();
 }
 
 void disableBufferedIO(void)
@@ -30,6 +50,8 @@ int main(int argc, char* argv[])
 {
     MCTS::PARAMS searchParams;
     EXPERIMENT::PARAMS expParams;
+    SERVER::PARAMS serverParams;
+    REGRESSION::PARAMS regressionParams;
     SIMULATOR::KNOWLEDGE knowledge;
     string problem, outputfile, policy;
     int size, number, treeknowledge = 1, rolloutknowledge = 1, smarttreecount = 10;
@@ -48,10 +70,12 @@ int main(int argc, char* argv[])
         ("mindoubles", value<int>(&expParams.MinDoubles), "minimum power of two simulations")
         ("maxdoubles", value<int>(&expParams.MaxDoubles), "maximum power of two simulations")
         ("runs", value<int>(&expParams.NumRuns), "number of runs")
+        ("runthreads", value<int>(&expParams.NumRunThreads), "number of runs to play in parallel")
         ("accuracy", value<double>(&expParams.Accuracy), "accuracy level used to determine horizon")
         ("horizon", value<int>(&expParams.UndiscountedHorizon), "horizon to use when not discounting")
         ("num steps", value<int>(&expParams.NumSteps), "number of steps to run when using average reward")
         ("verbose", value<int>(&searchParams.Verbose), "verbosity level")
+        ("seed", value<uint64_t>(&expParams.Seed), "random seed (run n uses the n-th stream of this seed)")
         ("autoexploration", value<bool>(&expParams.AutoExploration), "Automatically assign UCB exploration constant")
         ("exploration", value<double>(&searchParams.ExplorationConstant), "Manual value for UCB exploration constant")
         ("usetransforms", value<bool>(&searchParams.UseTransforms), "Use transforms")
@@ -68,6 +92,27 @@ int main(int argc, char* argv[])
         ("c_hat", value<double>(&searchParams.c_hat)->default_value(Infinity), "Cost constraint")
         ("lambdamax", value<double>(&searchParams.LambdaMax), "Maximum value of lambda")
         ("treealgorithm", value<int>(&searchParams.TreeAlgorithm), "Tree Algorithm (0: CCPOMCP, 1: baseline)")
+        ("threads", value<int>(&searchParams.NumThreads), "Number of search threads")
+        ("treeparallel", value<bool>(&searchParams.TreeParallel), "Search one shared tree with all threads (default: root parallelisation)")
+        ("virtualloss", value<int>(&searchParams.VirtualLoss), "Virtual visits per concurrent descent in tree parallel search")
+        ("reusetree", value<bool>(&searchParams.ReuseTree), "Keep the matching subtree as the next root after each step")
+        ("leafrollouts", value<int>(&searchParams.LeafRollouts), "Rollouts run in one batch from each new leaf, backing up their mean")
+        ("timebudget", value<double>(&searchParams.TimeBudget), "Seconds of search per decision (0: no limit), stopping before the number of simulations if reached")
+        ("stopinterval", value<int>(&searchParams.StopInterval), "Simulations between checks for a converged root policy (0: never stop early)")
+        ("stopchecks", value<int>(&searchParams.StopChecks), "Consecutive checks the root policy must be unchanged to stop early")
+        ("stoptolerance", value<double>(&searchParams.StopTolerance), "Largest change in the root policy's mixing probability counted as unchanged")
+        ("ponder", value<bool>(&searchParams.Ponder), "Keep searching below the chosen action until the real observation arrives")
+        ("particlefilter", value<bool>(&searchParams.ParticleFilter), "Update the root particles by importance weighting with the observation likelihood")
+        ("resamplethreshold", value<double>(&searchParams.ResampleThreshold), "Effective sample size, as a fraction of the start states, below which the particle filter resamples")
+        ("server", "serve planning sessions over stdin and stdout (see server.h), searching with 2^maxdoubles simulations on one thread each, without pondering")
+        ("serverworkers", value<int>(&serverParams.NumWorkers), "number of threads serving the sessions")
+        ("regression", value<string>(&regressionParams.BaselineFile), "benchmark fixed-seed rocksample episodes against this baseline file (see regression.h), failing on a regression")
+        ("regressionthreshold", value<double>(&regressionParams.Threshold), "fraction by which a regression benchmark measure may be worse than its baseline")
+        ("regressionrepeats", value<int>(&regressionParams.Repeats), "times each regression benchmark layout is measured, the median being compared")
+        ("writebaseline", value<bool>(&regressionParams.WriteBaseline), "write the regression benchmark measures to the baseline file instead of comparing")
+#ifdef PROFILING
+        ("profile", value<string>(&expParams.ProfileFile), "write search phase timings of each real step to this file, as JSON lines")
+#endif
         ;
 
     variables_map vm;
@@ -80,6 +125,12 @@ int main(int argc, char* argv[])
         return 1;
     }
 
+    if (vm.count("regression"))
+    {
+        REGRESSION regression(searchParams, regressionParams);
+        return regression.Run(cout) ? 0 : 1;
+    }
+
     if (vm.count("problem") == 0)
     {
         cout << "No problem specified" << endl;
@@ -109,8 +160,28 @@ int main(int argc, char* argv[])
 
 
     simulator->SetKnowledge(knowledge);
-    EXPERIMENT experiment(*real, *simulator, outputfile, expParams, searchParams);
-    experiment.DiscountedReturn();
+    if (vm.count("server"))
+    {
+        // Search as the batch runs with the most simulations do
+        if (expParams.AutoExploration)
+            searchParams.ExplorationConstant = searchParams.UseRave ? 0 : simulator->GetRewardRange();
+        searchParams.MaxDepth = simulator->GetHorizon(expParams.Accuracy, expParams.UndiscountedHorizon);
+        searchParams.NumSimulations = 1 << expParams.MaxDoubles;
+        searchParams.NumStartStates = 1 << expParams.MaxDoubles;
+        if (expParams.MaxDoubles + expParams.TransformDoubles >= 0)
+            searchParams.NumTransforms = 1 << (expParams.MaxDoubles + expParams.TransformDoubles);
+        else
+            searchParams.NumTransforms = 1;
+        searchParams.MaxAttempts = searchParams.NumTransforms * expParams.TransformAttempts;
+
+        SERVER server(*simulator, searchParams, serverParams);
+        server.Serve(cin, cout);
+    }
+    else
+    {
+        EXPERIMENT experiment(*real, *simulator, outputfile, expParams, searchParams);
+        experiment.DiscountedReturn();
+    }
 
     delete real;
     delete simulator;
@@ -1,9 +1,15 @@
 #include "mcts.h"
+#include "bench.h"
+#include "selection.h"
 #include "testsimulator.h"
 #include <math.h>
 #include <stdio.h>
 
 #include <algorithm>
+#include <chrono>
+#include <numeric>
+#include <sstream>
+#include <thread>
 
 using namespace std;
 using namespace UTILS;
@@ -25,22 +31,44 @@ MCTS::PARAMS::PARAMS()
     RaveConstant(0.01),
     DisableTree(false),
     LambdaMax(100.0),
-    TreeAlgorithm(0)
+    c_hat(Infinity),
+    TreeAlgorithm(0),
+    NumThreads(1),
+    TreeParallel(false),
+    VirtualLoss(1),
+    ReuseTree(true),
+    LeafRollouts(1),
+    TimeBudget(0),
+    StopInterval(0),
+    StopChecks(4),
+    StopTolerance(0.01),
+    Ponder(false),
+    ParticleFilter(false),
+    ResampleThreshold(0.5)
 {
 }
 
 MCTS::MCTS(const SIMULATOR& simulator, const PARAMS& params)
 :   Simulator(simulator),
-    Params(params),
     TreeDepth(0),
+    Params(params),
+    CompactedBytes(0),
+    TreeOwner(this),
+    SharedTree(false),
 	lambda(2),
 	lambdaMax(params.LambdaMax),
 	c_hat(params.c_hat),
 	initial_c_hat(params.c_hat),
-	TreeAlgorithm(params.TreeAlgorithm)
+	TreeAlgorithm(params.TreeAlgorithm),
+    SimulationsRun(0),
+    NodesExpanded(0),
+    Converged(false),
+    Ponderer(0),
+    StopPonder(false),
+    SimulationsPondered(0),
+    BonusTable(BonusTableSize)
 {
-    VNODE::NumChildren = Simulator.GetNumActions();
-    QNODE::NumChildren = Simulator.GetNumObservations();
+    SELECTION::FillBonusTable(Params.ExplorationConstant, BonusTableSize, &BonusTable[0]);
 
     Root = ExpandNode(Simulator.CreateStartState());
 
@@ -48,25 +76,64 @@ MCTS::MCTS(const SIMULATOR& simulator, const PARAMS& params)
         Root->Beliefs().AddSample(Simulator.CreateStartState());
 }
 
+MCTS::MCTS(MCTS& master, bool shareTree)
+:   Simulator(master.Simulator),
+    TreeDepth(0),
+    Params(master.Params),
+    CompactedBytes(0),
+    TreeOwner(shareTree ? &master : this),
+    SharedTree(shareTree),
+    History(master.History),
+    Status(master.Status),
+    lambda(master.lambda),
+    lambdaMax(master.lambdaMax),
+    c_hat(master.c_hat),
+    initial_c_hat(master.initial_c_hat),
+    TreeAlgorithm(master.TreeAlgorithm),
+    SearchTimer(master.SearchTimer),
+    SimulationsRun(0),
+    NodesExpanded(0),
+    Converged(false),
+    Ponderer(0),
+    StopPonder(false),
+    SimulationsPondered(0),
+    BonusTable(master.BonusTable)
+{
+    Params.NumThreads = 1;
+    Params.Verbose = 0;
+    if (shareTree)
+        Root = master.Root;
+    else
+        Root = ExpandNode(master.Root->Beliefs().GetSample(0));
+}
+
 MCTS::~MCTS()
 {
-    VNODE::Free(Root, Simulator);
-    VNODE::FreeAll();
+    StopPondering();
+    if (TreeOwner == this)
+        VNODE::FreeTree(Root, Simulator, Arena);
 }
 
 bool MCTS::Update(int action, int observation, RC rewardcost)
 {
+    StopPondering();
     History.Add(action, observation);
     BELIEF_STATE beliefs;
 
     // Find matching vnode from the rest of the tree
-    QNODE& qnode = Root->Child(action);
+    QNODE qnode = Root->Child(action);
     VNODE* vnode = qnode.Child(observation);
-    if (vnode)
+    if (Params.ParticleFilter)
+    {
+        PROFILE_SCOPE(Profile, FILTER_BELIEFS);
+        FilterBeliefs(action, observation, beliefs);
+    }
+    else if (vnode)
     {
         if (Params.Verbose >= 1)
             cout << "Matched " << vnode->Beliefs().GetNumSamples() << " states" << endl;
-        beliefs.Copy(vnode->Beliefs(), Simulator);
+        // Take ownership of the particles, which the old tree would free
+        beliefs.Move(vnode->Beliefs());
     }
     else
     {
@@ -75,37 +142,71 @@ bool MCTS::Update(int action, int observation, RC rewardcost)
     }
 
     // Generate transformed states to avoid particle deprivation
-    if (Params.UseTransforms)
+    if (Params.UseTransforms && !Params.ParticleFilter)
+    {
+        PROFILE_SCOPE(Profile, ADD_TRANSFORMS);
         AddTransforms(Root, beliefs);
+    }
 
     // If we still have no particles, fail
-    if (beliefs.Empty() && (!vnode || vnode->Beliefs().Empty()))
+    if (beliefs.Empty())
         return false;
 
     if (Params.Verbose >= 1)
         Simulator.DisplayBeliefs(beliefs, cout);
 
-    // Find a state to initialise prior (only requires fully observed state)
-    const STATE* state = 0;
-    if (vnode && !vnode->Beliefs().Empty())
-        state = vnode->Beliefs().GetSample(0);
+    VNODE* newRoot;
+    if (vnode && Params.ReuseTree)
+    {
+        // Keep the matching subtree as the new root where it lies, handing
+        // the last search's arena to the spare arena that holds the older
+        // nodes. Nothing is copied until the spare arena has doubled since
+        // it was last compacted, which bounds both the garbage it holds and
+        // the copying, amortised over the searches in between.
+        PROFILE_START(freeStart);
+        VNODE::Prune(Root, vnode, Simulator);
+        PROFILE_STOP(Profile, FREE_TREE, freeStart, 1);
+        SpareArena.Absorb(Arena);
+        newRoot = vnode;
+        if (SpareArena.GetNumAllocated() > 2 * CompactedBytes)
+        {
+            PROFILE_START(copyStart);
+            newRoot = VNODE::Relocate(vnode, Arena, Simulator);
+            SpareArena.Reset();
+            Arena.Swap(SpareArena);
+            CompactedBytes = SpareArena.GetNumAllocated();
+            PROFILE_STOP(Profile, REUSE_SUBTREE, copyStart, 1);
+        }
+    }
     else
-        state = beliefs.GetSample(0);
-
-    // Delete old tree and create new root
-    VNODE::Free(Root, Simulator);
-    VNODE* newRoot = ExpandNode(state);
-    newRoot->Beliefs() = beliefs;
+    {
+        // Find a state to initialise prior (only requires fully observed
+        // state)
+        const STATE* state = beliefs.GetSample(0);
+
+        // Delete old tree and create new root
+        PROFILE_START(freeStart);
+        VNODE::FreeTree(Root, Simulator, Arena);
+        SpareArena.Reset();
+        CompactedBytes = 0;
+        PROFILE_STOP(Profile, FREE_TREE, freeStart, 1);
+        newRoot = ExpandNode(state);
+    }
+    newRoot->Beliefs().Move(beliefs);
     Root = newRoot;
     return true;
 }
 
 Policy MCTS::SelectAction()
 {
+    StopPondering();
+    SearchTimer.Restart();
+    Converged = false;
     if (Params.DisableTree)
         RolloutSearch();
     else
         UCTSearch();
+    Profile.SetNodePoolBytes(Arena.GetNumAllocated() + SpareArena.GetNumAllocated());
     return GreedyUCB(Root, false, true);
 }
 
@@ -116,23 +217,29 @@ void MCTS::RolloutSearch()
 	std::vector<int> legal;
 	assert(BeliefState().GetNumSamples() > 0);
 	Simulator.GenerateLegal(*BeliefState().GetSample(0), GetHistory(), legal, GetStatus());
-	random_shuffle(legal.begin(), legal.end());
+	shuffle(legal.begin(), legal.end(), Generator());
 
-	for (int i = 0; i < Params.NumSimulations; i++)
+	int i;
+	for (i = 0; i < Params.NumSimulations && !OutOfTime(i); i++)
 	{
 		int action = legal[i % legal.size()];
+		PROFILE_START(sampleStart);
 		STATE* state = Root->Beliefs().CreateSample(Simulator);
+		PROFILE_STOP(Profile, CREATE_SAMPLE, sampleStart, 1);
 		Simulator.Validate(*state);
 
 		int observation;
 		RC immediateRewardCost, delayedRewardCost, totalRewardCost;
+		PROFILE_START(stepStart);
 		bool terminal = Simulator.Step(*state, action, observation, immediateRewardCost);
+		PROFILE_STOP(Profile, TREE_STEP, stepStart, 1);
 
 		VNODE*& vnode = Root->Child(action).Child(observation);
 		if (!vnode && !terminal)
 		{
 			vnode = ExpandNode(state);
-			AddSample(vnode, *state);
+			if (!Params.ParticleFilter)
+				AddSample(vnode, *state);
 		}
 		History.Add(action, observation);
 
@@ -143,16 +250,160 @@ void MCTS::RolloutSearch()
 		Simulator.FreeState(state);
 		History.Truncate(historyDepth);
 	}
+	SimulationsRun = i;
 }
 
 void MCTS::UCTSearch()
 {
     ClearStatistics();
+    if (Params.NumThreads > 1)
+        ParallelUCTSearch();
+    else
+        SimulationsRun = RunSimulations(Root->Beliefs(), Params.NumSimulations);
+    DisplayStatistics(cout);
+}
+
+void MCTS::ParallelUCTSearch()
+{
+    // Root parallelisation: every thread grows an independent tree from the
+    // same root beliefs, and the root statistics are merged afterwards.
+    // Tree parallelisation: all threads descend the master's tree together,
+    // with lock-free statistics and virtual loss to spread them out.
+    SharedTree = Params.TreeParallel;
+    vector<MCTS*> workers;
+    vector<thread> threads;
+    for (int i = 1; i < Params.NumThreads; i++)
+    {
+        MCTS* worker = new MCTS(*this, Params.TreeParallel);
+        int numSimulations = (Params.NumSimulations + i) / Params.NumThreads;
+        threads.push_back(thread(&MCTS::SearchWorker, worker,
+            cref(Root->Beliefs()), numSimulations, Generator().Next()));
+        workers.push_back(worker);
+    }
+
+    SimulationsRun = RunSimulations(Root->Beliefs(), Params.NumSimulations / Params.NumThreads);
+
+    double totalLambda = lambda;
+    for (int i = 0; i < (int) workers.size(); i++)
+    {
+        threads[i].join();
+        SimulationsRun += workers[i]->SimulationsRun;
+        NodesExpanded += workers[i]->NodesExpanded;
+        Profile.Merge(workers[i]->Profile);
+        if (!Params.TreeParallel)
+            MergeRoot(*workers[i]);
+        totalLambda += workers[i]->lambda;
+        delete workers[i];
+    }
+    lambda = totalLambda / Params.NumThreads;
+    SharedTree = false;
+}
+
+void MCTS::SearchWorker(const BELIEF_STATE& beliefs, int numSimulations, uint64_t seed)
+{
+    RandomSeed(seed);
+    SimulationsRun = RunSimulations(beliefs, numSimulations);
+}
+
+// Pondering runs a worker on the master's tree, as in tree parallel search,
+// while the caller executes the action. Only the chosen action's subtree is
+// touched, and Update then keeps the matching part of it as the new root.
+void MCTS::StartPondering(int action)
+{
+    StopPondering();
+    SimulationsPondered = 0;
+    if (!Params.Ponder || !Params.ReuseTree || Params.DisableTree)
+        return;
+    StopPonder = false;
+    Ponderer = new MCTS(*this, true);
+    PonderThread = thread(&MCTS::Ponder, Ponderer, action, Generator().Next());
+}
+
+void MCTS::StopPondering()
+{
+    if (!Ponderer)
+        return;
+    StopPonder = true;
+    PonderThread.join();
+    SimulationsPondered = Ponderer->SimulationsRun;
+    NodesExpanded += Ponderer->NodesExpanded;
+    Profile.Merge(Ponderer->Profile);
+    delete Ponderer;
+    Ponderer = 0;
+    if (Params.Verbose >= 1)
+        cout << "Pondered " << SimulationsPondered << " simulations" << endl;
+}
+
+// Simulations that take action at the root, so that particles and
+// statistics accumulate below each of its observations
+void MCTS::Ponder(int action, uint64_t seed)
+{
+    RandomSeed(seed);
     int historyDepth = History.Size();
 
-    for (int n = 0; n < Params.NumSimulations; n++)
+    int n;
+    for (n = 0; n < Params.NumSimulations && !TreeOwner->StopPonder; n++)
     {
+        PROFILE_START(sampleStart);
         STATE* state = Root->Beliefs().CreateSample(Simulator);
+        PROFILE_STOP(Profile, CREATE_SAMPLE, sampleStart, 1);
+        Status.Phase = SIMULATOR::STATUS::TREE;
+        TreeDepth = 0;
+        PeakTreeDepth = 0;
+        QNODE qnode = Root->Child(action);
+        SimulateQ(*state, qnode, action);
+        Simulator.FreeState(state);
+        History.Truncate(historyDepth);
+    }
+    SimulationsRun = n;
+}
+
+void MCTS::MergeRoot(MCTS& worker)
+{
+    Root->Value.Merge(worker.Root->Value);
+    for (int action = 0; action < Simulator.GetNumActions(); action++)
+    {
+        QNODE qnode = Root->Child(action);
+        QNODE workerQnode = worker.Root->Child(action);
+        qnode.Value.Merge(workerQnode.Value);
+        qnode.AMAF.Merge(workerQnode.AMAF);
+
+        // Take over the particles gathered at depth one, so that Update
+        // finds the beliefs of every worker under the matching node
+        for (int observation = 0; observation < Simulator.GetNumObservations(); observation++)
+        {
+            VNODE* workerVnode = workerQnode.Child(observation);
+            if (!workerVnode || workerVnode->Beliefs().Empty())
+                continue;
+
+            VNODE*& vnode = qnode.Child(observation);
+            if (!vnode)
+            {
+                History.Add(action, observation);
+                vnode = ExpandNode(workerVnode->Beliefs().GetSample(0));
+                History.Pop();
+            }
+            vnode->Beliefs().Move(workerVnode->Beliefs());
+        }
+    }
+}
+
+// Runs up to numSimulations, stopping early when the time budget runs out
+// or the root policy converges, and returns the number run. The lambda step
+// size depends only on the simulations run so far, so it is unaffected by
+// stopping early.
+int MCTS::RunSimulations(const BELIEF_STATE& beliefs, int numSimulations)
+{
+    int historyDepth = History.Size();
+    CONVERGENCE convergence;
+
+    int n;
+    for (n = 0; n < numSimulations && !OutOfTime(n)
+        && !HasConverged(n, convergence); n++)
+    {
+        PROFILE_START(sampleStart);
+        STATE* state = beliefs.CreateSample(Simulator);
+        PROFILE_STOP(Profile, CREATE_SAMPLE, sampleStart, 1);
         Simulator.Validate(*state);
         Status.Phase = SIMULATOR::STATUS::TREE;
         if (Params.Verbose >= 2)
@@ -194,7 +445,44 @@ void MCTS::UCTSearch()
         Simulator.FreeState(state);
         History.Truncate(historyDepth);
     }
-    DisplayStatistics(cout);
+    return n;
+}
+
+// The clock is read only every few simulations, and never before the first,
+// so that a search always has a root value to act on
+bool MCTS::OutOfTime(int numSimulations) const
+{
+    return Params.TimeBudget > 0 && numSimulations > 0
+        && numSimulations % TimeCheckInterval == 0
+        && SearchTimer.Elapsed() >= Params.TimeBudget;
+}
+
+// Every StopInterval simulations, compare the greedy root policy with the
+// one at the previous check. Threads sharing a tree stop together once any
+// of them sees it converge; root parallel workers each judge their own tree.
+bool MCTS::HasConverged(int numSimulations, CONVERGENCE& convergence)
+{
+    if (TreeOwner->Converged)
+        return true;
+    if (Params.StopInterval <= 0 || numSimulations == 0
+        || numSimulations % Params.StopInterval != 0)
+        return false;
+
+    Policy policy = GreedyUCB(Root, false, true);
+    bool stable = convergence.StableChecks >= 0
+        && policy.getMinCostAction() == convergence.MinCostAction
+        && policy.getMaxCostAction() == convergence.MaxCostAction
+        && fabs(policy.getProbMinCostAction() - convergence.ProbMinCostAction)
+            <= Params.StopTolerance;
+    convergence.StableChecks = stable ? convergence.StableChecks + 1 : 0;
+    convergence.MinCostAction = policy.getMinCostAction();
+    convergence.MaxCostAction = policy.getMaxCostAction();
+    convergence.ProbMinCostAction = policy.getProbMinCostAction();
+
+    if (convergence.StableChecks < Params.StopChecks)
+        return false;
+    TreeOwner->Converged = true;
+    return true;
 }
 
 RC MCTS::Simulate(const BELIEF_STATE &beliefs, int iteration)
@@ -241,10 +529,20 @@ RC MCTS::SimulateV(STATE& state, VNODE* vnode)
     if (TreeDepth >= Params.MaxDepth) // search horizon reached
         return RC(0, 0);
 
-    if (TreeDepth == 1)
+    if (TreeDepth == 1 && !Params.ParticleFilter)
         AddSample(vnode, state);
 
-    QNODE& qnode = vnode->Child(action);
+    QNODE qnode = vnode->Child(action);
+    if (SharedTree)
+    {
+        qnode.AddVirtualLoss(+1);
+        RC totalRewardCost = SimulateQ(state, qnode, action);
+        qnode.AddVirtualLoss(-1);
+        vnode->Value.AtomicAdd(totalRewardCost);
+        AddRave(vnode, totalRewardCost);
+        return totalRewardCost;
+    }
+
     RC totalRewardCost = SimulateQ(state, qnode, action);
     vnode->Value.Add(totalRewardCost);
     AddRave(vnode, totalRewardCost);
@@ -258,7 +556,9 @@ RC MCTS::SimulateQ(STATE& state, QNODE& qnode, int action)
 
     if (Simulator.HasAlpha())
         Simulator.UpdateAlpha(qnode, state);
+    PROFILE_START(stepStart);
     bool terminal = Simulator.Step(state, action, observation, immediateRewardCost);
+    PROFILE_STOP(Profile, TREE_STEP, stepStart, 1);
     assert(observation >= 0 && observation < Simulator.GetNumObservations());
     History.Add(action, observation);
 
@@ -270,9 +570,20 @@ RC MCTS::SimulateQ(STATE& state, QNODE& qnode, int action)
         Simulator.DisplayState(state, cout);
     }
 
-    VNODE*& vnode = qnode.Child(observation);
+    VNODE* vnode = SharedTree ? qnode.LoadChild(observation) : qnode.Child(observation);
     if (!vnode && !terminal && qnode.Value.GetCount() >= Params.ExpandCount)
+    {
         vnode = ExpandNode(&state);
+        if (!SharedTree)
+            qnode.Child(observation) = vnode;
+        else
+        {
+            VNODE* installed = qnode.InstallChild(observation, vnode);
+            if (installed != vnode)
+                VNODE::Destroy(vnode, Simulator);
+            vnode = installed;
+        }
+    }
 
     if (!terminal)
     {
@@ -280,12 +591,15 @@ RC MCTS::SimulateQ(STATE& state, QNODE& qnode, int action)
         if (vnode)
             delayedRewardCost = SimulateV(state, vnode);
         else
-            delayedRewardCost = Rollout(state);
+            delayedRewardCost = Rollout(state, Params.LeafRollouts);
         TreeDepth--;
     }
 
     RC totalRewardCost = immediateRewardCost + Simulator.GetDiscount() * delayedRewardCost;
-    qnode.Value.Add(totalRewardCost);
+    if (SharedTree)
+        qnode.Value.AtomicAdd(totalRewardCost);
+    else
+        qnode.Value.Add(totalRewardCost);
     return totalRewardCost;
 }
 
@@ -294,15 +608,21 @@ void MCTS::AddRave(VNODE* vnode, RC totalRewardCost)
     double totalDiscount = 1.0;
     for (int t = TreeDepth; t < History.Size(); ++t)
     {
-        QNODE& qnode = vnode->Child(History[t].Action);
-        qnode.AMAF.Add(totalRewardCost, totalDiscount);
+        QNODE qnode = vnode->Child(History[t].Action);
+        if (SharedTree)
+            qnode.AMAF.AtomicAdd(totalRewardCost, totalDiscount);
+        else
+            qnode.AMAF.Add(totalRewardCost, totalDiscount);
         totalDiscount *= Params.RaveDiscount;
     }
 }
 
 VNODE* MCTS::ExpandNode(const STATE* state)
 {
-    VNODE* vnode = VNODE::Create();
+    PROFILE_SCOPE(Profile, EXPAND_NODE);
+    VNODE* vnode = VNODE::Create(TreeOwner->Arena, Simulator.GetNumActions(),
+        Simulator.GetNumObservations(), Simulator.HasAlpha());
+    NodesExpanded++;
     vnode->Value.Set(0, RC(0.0, 0.0));
     Simulator.Prior(state, History, vnode, Status);
 
@@ -318,8 +638,16 @@ VNODE* MCTS::ExpandNode(const STATE* state)
 
 void MCTS::AddSample(VNODE* node, const STATE& state)
 {
+    PROFILE_START(copyStart);
     STATE* sample = Simulator.Copy(state);
-    node->Beliefs().AddSample(sample);
+    PROFILE_STOP(Profile, COPY_STATE, copyStart, 1);
+    if (SharedTree)
+    {
+        lock_guard<mutex> lock(TreeOwner->SampleMutex);
+        node->Beliefs().AddSample(sample);
+    }
+    else
+        node->Beliefs().AddSample(sample);
     if (Params.Verbose >= 2)
     {
         cout << "Adding sample:" << endl;
@@ -329,67 +657,80 @@ void MCTS::AddSample(VNODE* node, const STATE& state)
 
 Policy MCTS::GreedyUCB(VNODE* vnode, bool ucb, bool stochastic) const
 {
-    static vector<int> besta; besta.clear();
-    double bestQ = -Infinity, bestQplus = -Infinity;
+    PROFILE_SCOPE(Profile, GREEDY_UCB);
+    // Statistics are read once per action, so that both passes below agree
+    // even while other threads update the tree
+    vector<double>& actionQ = Scratch.ActionQ;
+    vector<double>& actionC = Scratch.ActionC;
+    vector<double>& actionQplus = Scratch.ActionQplus;
+    vector<double>& selectQ = Scratch.SelectQ;
+    vector<int>& actionN = Scratch.ActionN;
+    vector<int>& besta = Scratch.BestA;
+    vector<int>& tied = Scratch.Tied;
+    int numActions = Simulator.GetNumActions();
+    actionQ.resize(numActions);
+    actionC.resize(numActions);
+    actionQplus.resize(numActions);
+    actionN.resize(numActions);
+    besta.resize(numActions);
+    tied.resize(numActions);
     int N = vnode->Value.GetCount();
-    double logN = log(N + 1);
     bool hasalpha = Simulator.HasAlpha();
 
-    for (int action = 0; action < Simulator.GetNumActions(); action++)
+    SELECTION::EVALUATION eval;
+    eval.Counts = vnode->GetCounts();
+    eval.TotalR = vnode->GetTotalR();
+    eval.TotalC = vnode->GetTotalC();
+    eval.VirtualLoss = ucb ? vnode->GetVirtualLosses() : 0;
+    eval.VirtualLossScale = Params.VirtualLoss;
+    eval.RewardRange = Simulator.GetRewardRange();
+    eval.Lambda = lambda;  // scalarized value
+    SELECTION::Evaluate(numActions, eval, &actionQ[0], &actionC[0], &actionN[0]);
+
+    // RAVE and alpha vectors adjust the value used for selection only
+    const double* Q = &actionQ[0];
+    if (Params.UseRave || hasalpha)
     {
-        double Q, Qplus, alphaq;
-        int n, alphan;
-
-        QNODE& qnode = vnode->Child(action);
-        Q = qnode.Value.GetValue().R - lambda * qnode.Value.GetValue().C;  // scalarized value
-        n = qnode.Value.GetCount();
-
-        if (Params.UseRave && qnode.AMAF.GetCount() > 0)
+        selectQ = actionQ;
+        for (int action = 0; action < numActions; action++)
         {
-            double n2 = qnode.AMAF.GetCount();
-            double beta = n2 / (n + n2 + Params.RaveConstant * n * n2);
-            Q = (1.0 - beta) * Q + beta * (qnode.AMAF.GetValue().R - lambda * qnode.AMAF.GetValue().C);  // scalarized value
-            assert(false); // test...
-        }
-
-        if (hasalpha && n > 0)
-        {
-            Simulator.AlphaValue(qnode, alphaq, alphan);
-            Q = (n * Q + alphan * alphaq) / (n + alphan);
-            assert(false); // test...
-        }
+            QNODE qnode = vnode->Child(action);
+            double alphaq;
+            int n = actionN[action], alphan;
 
-        Qplus = Q;
-        if (ucb) {
-            Qplus += FastUCB(N, n, logN);
-        }
-
-        if (TreeAlgorithm == 0) { //CCPOMCP
-            if (Qplus >= bestQplus)
+            if (Params.UseRave && qnode.AMAF.GetCount() > 0)
             {
-                if (Qplus > bestQplus)
-                    besta.clear();
-                bestQplus = Qplus;
-                bestQ = Q;
-                besta.push_back(action);
+                double n2 = qnode.AMAF.GetCount();
+                double beta = n2 / (n + n2 + Params.RaveConstant * n * n2);
+                selectQ[action] = (1.0 - beta) * selectQ[action] + beta * (qnode.AMAF.GetValue().R - lambda * qnode.AMAF.GetValue().C);  // scalarized value
+                assert(false); // test...
             }
-        } else if (TreeAlgorithm == 1) { // Baseline
-            if (qnode.Value.GetValue().C < c_hat && Qplus >= bestQplus) {
-                if (Qplus > bestQplus)
-                    besta.clear();
-                bestQplus = Qplus;
-                bestQ = Q;
-                besta.push_back(action);
+
+            if (hasalpha && n > 0)
+            {
+                Simulator.AlphaValue(qnode, alphaq, alphan);
+                selectQ[action] = (n * selectQ[action] + alphan * alphaq) / (n + alphan);
+                assert(false); // test...
             }
         }
+        Q = &selectQ[0];
     }
 
+    SELECTION::BONUS bonus;
+    bonus.Table = &BonusTable[0];
+    bonus.TableSize = BonusTableSize;
+    bonus.Exploration = Params.ExplorationConstant;
+    bonus.SqrtLogN = sqrt(log(N + 1));
+    bool baseline = TreeAlgorithm == 1;
+    int numBest = SELECTION::SelectBest(numActions, Q, &actionC[0], &actionN[0],
+        ucb ? &bonus : 0, baseline, c_hat, &actionQplus[0], &besta[0]);
+
     //Baseline
-    if (TreeAlgorithm == 1){
-        if (besta.size() == 0) {
+    if (baseline){
+        if (numBest == 0) {
             // Random action (among legal actions)
             while (true) {
-                int action = Random(vnode->NumChildren);
+                int action = Random(numActions);
                 if (vnode->Child(action).Value.GetCount() == 0 || vnode->Child(action).Value.GetValue().R > -Infinity) {
                     Policy policy;
                     policy.setPolicy(0, 0, action, action, 0);
@@ -397,7 +738,7 @@ Policy MCTS::GreedyUCB(VNODE* vnode, bool ucb, bool stochastic) const
                 }
             }
         } else {
-            int action = besta[Random(besta.size())];
+            int action = besta[Random(numBest)];
             Policy policy;
             policy.setPolicy(0, 0, action, action, 0);
             return policy;
@@ -405,22 +746,35 @@ Policy MCTS::GreedyUCB(VNODE* vnode, bool ucb, bool stochastic) const
     }
     //Else: CCPOMCP
 
-    int bestAction = besta[Random(besta.size())];
+    int bestAction = besta[Random(numBest)];
 
-    // additionally, add tied actions
+    // An untried action wins outright, as it cannot tie with the others
+    Policy policy;
+    if (ucb && actionN[bestAction] == 0)
+    {
+        policy.setPolicy(actionC[bestAction], actionC[bestAction], bestAction, bestAction, c_hat);
+        return policy;
+    }
+
+    // additionally, add tied actions, judged by the same value (Q plus the
+    // UCB bonus when exploring) that chose the best action
     const double biasconstant = exp(-TreeDepth) * 0.1;
     double minCost = Infinity, maxCost = -Infinity;
     int minCostAction = -1, maxCostAction = -1;
+    double bestQ = actionQplus[bestAction];
 
-    int bestActionN = vnode->Child(bestAction).Value.GetCount();
-    double bestActionQ = vnode->Child(bestAction).Value.GetValue().R - lambda * vnode->Child(bestAction).Value.GetValue().C;
+    int bestActionN = actionN[bestAction];
     double bestActionBias = biasconstant * (log(bestActionN + 1) / (bestActionN + 1));
-    for (int action = 0; action < Simulator.GetNumActions(); action++) {
-        QNODE& qnode = vnode->Child(action);
-        double Q_R = qnode.Value.GetValue().R;
-        double Q_C = qnode.Value.GetValue().C;
-        double q = Q_R - lambda * Q_C;  // scalarized value
-        int n = qnode.Value.GetCount();
+
+    // log(n + 1) / (n + 1) never exceeds 0.37 for integer n, so only actions
+    // within this bound of bestQ can be tied
+    double bound = (stochastic) ? bestActionBias + biasconstant * 0.37 : 0.0;
+    int numTied = SELECTION::Within(numActions, &actionQplus[0], bestQ, bound, &tied[0]);
+    for (int i = 0; i < numTied; i++) {
+        int action = tied[i];
+        double Q_C = actionC[action];
+        double q = actionQplus[action];  // scalarized value, plus the bonus when exploring
+        int n = actionN[action];
         double actionBias = biasconstant * (log(n + 1) / (n + 1));
 
         double threshold = (stochastic) ? bestActionBias + actionBias : 0.0;
@@ -436,41 +790,81 @@ Policy MCTS::GreedyUCB(VNODE* vnode, bool ucb, bool stochastic) const
         }
     }
 
-    Policy policy;
     policy.setPolicy(minCost, maxCost, minCostAction, maxCostAction, c_hat);
 
     return policy;
 }
 
-RC MCTS::Rollout(STATE& state)
+RC MCTS::Rollout(STATE& state, int numRollouts)
 {
     Status.Phase = SIMULATOR::STATUS::ROLLOUT;
     if (Params.Verbose >= 3)
         cout << "Starting rollout" << endl;
 
     RC totalRewardCost(0.0, 0.0);
-    double discount = 1.0;
-    bool terminal = false;
     int numSteps;
-    for (numSteps = 0; numSteps + TreeDepth < Params.MaxDepth && !terminal; ++numSteps)
-    {
-        int observation;
-        RC rewardcost;
-
-        int action = Simulator.SelectRandom(state, History, Status);
-        terminal = Simulator.Step(state, action, observation, rewardcost);
-        History.Add(action, observation);
 
-        if (Params.Verbose >= 4)
+    // RAVE needs the rollout left in the history, and verbose output shows
+    // every step, otherwise the simulator may use its batched rollouts.
+    // Leaf-parallel rollouts run from copies of the state in the same batch,
+    // and return their mean.
+    if (!Params.UseRave && Params.Verbose < 4)
+    {
+        vector<STATE*>& states = Scratch.States;
+        vector<RC>& returns = Scratch.Returns;
+        vector<int>& steps = Scratch.Steps;
+        states.assign(1, &state);
+        PROFILE_START(copyStart);
+        for (int i = 1; i < numRollouts; ++i)
+            states.push_back(Simulator.Copy(state));
+        PROFILE_STOP(Profile, COPY_STATE, copyStart, numRollouts - 1);
+        returns.resize(numRollouts);
+        steps.resize(numRollouts);
+
+        PROFILE_START(rolloutStart);
+        Simulator.RolloutBatch(&states[0], numRollouts, History, Status,
+            Params.MaxDepth - TreeDepth, &returns[0], &steps[0]);
+        PROFILE_STOP(Profile, ROLLOUT_STEP, rolloutStart,
+            accumulate(steps.begin(), steps.end(), 0));
+
+        for (int i = 0; i < numRollouts; ++i)
+            totalRewardCost += returns[i];
+        totalRewardCost = totalRewardCost / numRollouts;
+
+        // The first rollout is recorded below, as a single rollout would be
+        numSteps = steps[0];
+        for (int i = 1; i < numRollouts; ++i)
         {
-            Simulator.DisplayAction(action, cout);
-            Simulator.DisplayObservation(state, observation, cout);
-            Simulator.DisplayRewardCost(rewardcost, cout);
-            Simulator.DisplayState(state, cout);
+            StatRolloutDepth.Add(steps[i]);
+            Simulator.FreeState(states[i]);
         }
+    }
+    else
+    {
+        double discount = 1.0;
+        bool terminal = false;
+        PROFILE_START(rolloutStart);
+        for (numSteps = 0; numSteps + TreeDepth < Params.MaxDepth && !terminal; ++numSteps)
+        {
+            int observation;
+            RC rewardcost;
+
+            int action = Simulator.SelectRandom(state, History, Status);
+            terminal = Simulator.Step(state, action, observation, rewardcost);
+            History.Add(action, observation);
 
-        totalRewardCost += rewardcost * discount;
-        discount *= Simulator.GetDiscount();
+            if (Params.Verbose >= 4)
+            {
+                Simulator.DisplayAction(action, cout);
+                Simulator.DisplayObservation(state, observation, cout);
+                Simulator.DisplayRewardCost(rewardcost, cout);
+                Simulator.DisplayState(state, cout);
+            }
+
+            totalRewardCost += rewardcost * discount;
+            discount *= Simulator.GetDiscount();
+        }
+        PROFILE_STOP(Profile, ROLLOUT_STEP, rolloutStart, numSteps);
     }
 
     StatRolloutDepth.Add(numSteps);
@@ -503,6 +897,74 @@ void MCTS::AddTransforms(VNODE* root, BELIEF_STATE& beliefs)
     }
 }
 
+// Move each root particle on by the real action, in place, and weight it by
+// the likelihood of the real observation. Should no particle explain the
+// observation, local moves of the rejected ones are weighted instead.
+// Resampling restores the particle budget once the weight has gathered on
+// too few particles.
+void MCTS::FilterBeliefs(int action, int observation, BELIEF_STATE& beliefs)
+{
+    vector<STATE*> particles;
+    vector<double> weights;
+    Root->Beliefs().Release(particles, weights);
+
+    vector<STATE*> rejected;
+    vector<int> rejectedObs;
+    vector<double> rejectedWeights;
+    for (int i = 0; i < (int) particles.size(); i++)
+    {
+        STATE* state = particles[i];
+        int stepObs;
+        RC stepRewardCost;
+        if (Simulator.Step(*state, action, stepObs, stepRewardCost))
+        {
+            Simulator.FreeState(state);
+            continue;
+        }
+        double weight = weights[i]
+            * Simulator.ObservationProbability(*state, action, observation, stepObs);
+        if (weight > 0)
+        {
+            Simulator.ConditionObservation(*state, action, observation, stepObs);
+            beliefs.AddSample(state, weight);
+        }
+        else
+        {
+            rejected.push_back(state);
+            rejectedObs.push_back(stepObs);
+            rejectedWeights.push_back(weights[i]);
+        }
+    }
+
+    bool reinvigorate = beliefs.Empty();
+    for (int i = 0; i < (int) rejected.size(); i++)
+    {
+        STATE* state = rejected[i];
+        // LocalMove only accepts states consistent with the real
+        // observation, which already conditions them on it, so they keep
+        // their prior weight
+        if (reinvigorate && Simulator.LocalMove(*state, History, rejectedObs[i], Status))
+        {
+            beliefs.AddSample(state, rejectedWeights[i]);
+            continue;
+        }
+        Simulator.FreeState(state);
+    }
+
+    double effectiveSamples = beliefs.GetEffectiveSampleSize();
+    bool resample = !beliefs.Empty()
+        && effectiveSamples < Params.ResampleThreshold * Params.NumStartStates;
+    if (resample)
+        beliefs.Resample(Params.NumStartStates, Simulator);
+
+    if (Params.Verbose >= 1)
+    {
+        cout << "Filtered " << particles.size() << " particles to "
+            << beliefs.GetNumSamples() << ", effective sample size "
+            << effectiveSamples << (resample ? ", resampled" : "") << endl;
+    }
+}
+
 STATE* MCTS::CreateTransform() const
 {
     int stepObs;
@@ -516,33 +978,6 @@ STATE* MCTS::CreateTransform() const
     return 0;
 }
 
-double MCTS::UCB[UCB_N][UCB_n];
-bool MCTS::InitialisedFastUCB = true;
-
-void MCTS::InitFastUCB(double exploration)
-{
-    cout << "Initialising fast UCB table... ";
-    for (int N = 0; N < UCB_N; ++N)
-        for (int n = 0; n < UCB_n; ++n)
-            if (n == 0)
-                UCB[N][n] = Infinity;
-            else
-                UCB[N][n] = exploration * sqrt(log(N + 1) / n);
-    cout << "done" << endl;
-    InitialisedFastUCB = true;
-}
-
-inline double MCTS::FastUCB(int N, int n, double logN) const
-{
-    if (InitialisedFastUCB && N < UCB_N && n < UCB_n)
-        return UCB[N][n];
-
-    if (n == 0)
-        return Infinity;
-    else
-        return Params.ExplorationConstant * sqrt(logN / n);
-}
-
 void MCTS::ClearStatistics()
 {
     StatTreeDepth.Clear();
@@ -561,9 +996,9 @@ void MCTS::DisplayStatistics(ostream& ostr) const
 
     if (Params.Verbose >= 2)
     {
-        ostr << "Policy after " << Params.NumSimulations << " simulations" << endl;
+        ostr << "Policy after " << SimulationsRun << " simulations" << endl;
         DisplayPolicy(6, ostr);
-        ostr << "Values after " << Params.NumSimulations << " simulations" << endl;
+        ostr << "Values after " << SimulationsRun << " simulations" << endl;
         DisplayValue(6, ostr);
     }
 }
@@ -591,6 +1026,18 @@ void MCTS::UnitTest()
     UnitTestRollout();
     for (int depth = 1; depth <= 3; ++depth)
         UnitTestSearch(depth);
+    for (int depth = 1; depth <= 3; ++depth)
+    {
+        UnitTestParallelSearch(depth, false);
+        UnitTestParallelSearch(depth, true);
+    }
+    UnitTestReuse();
+    UnitTestLeafRollouts();
+    UnitTestTimeBudget();
+    UnitTestConvergence();
+    UnitTestPonder();
+    UnitTestIndependentSearches();
+    UnitTestParticleFilter();
 }
 
 void MCTS::UnitTestGreedy()
@@ -614,6 +1061,9 @@ void MCTS::UnitTestUCB()
     TEST_SIMULATOR testSimulator(5, 5, 0);
     PARAMS params;
     MCTS mcts(testSimulator, params);
+    // These cases are about the UCB bonus alone: reward only, and no band
+    // of stochastic ties, which is wider than the bonus differences here
+    mcts.lambda = 0;
     int numAct = testSimulator.GetNumActions();
     int numObs = testSimulator.GetNumObservations();
 
@@ -625,7 +1075,7 @@ void MCTS::UnitTestUCB()
             vnode1->Child(action).Value.Set(99, RC(0, 0));
         else
             vnode1->Child(action).Value.Set(100 + action, RC(0, 0));
-    assert(mcts.GreedyUCB(vnode1, true, true).sampleAction() == 3);
+    assert(mcts.GreedyUCB(vnode1, true, false).sampleAction() == 3);
 
     // With high counts, action with highest value is selected
     VNODE* vnode2 = mcts.ExpandNode(testSimulator.CreateStartState());
@@ -635,7 +1085,7 @@ void MCTS::UnitTestUCB()
             vnode2->Child(action).Value.Set(99 + numObs, RC(1, 1));
         else
             vnode2->Child(action).Value.Set(100 + numAct - action, RC(0, 0));
-    assert(mcts.GreedyUCB(vnode2, true, true).sampleAction() == 3);
+    assert(mcts.GreedyUCB(vnode2, true, false).sampleAction() == 3);
 
     // Action with low value and low count beats actions with high counts
     VNODE* vnode3 = mcts.ExpandNode(testSimulator.CreateStartState());
@@ -645,7 +1095,7 @@ void MCTS::UnitTestUCB()
             vnode3->Child(action).Value.Set(1, RC(1, 1));
         else
             vnode3->Child(action).Value.Set(100 + action, RC(1, 1));
-    assert(mcts.GreedyUCB(vnode3, true, true).sampleAction() == 3);
+    assert(mcts.GreedyUCB(vnode3, true, false).sampleAction() == 3);
 
     // Actions with zero count is always selected
     VNODE* vnode4 = mcts.ExpandNode(testSimulator.CreateStartState());
@@ -677,6 +1127,91 @@ void MCTS::UnitTestRollout()
     assert(fabs(meanValue.R - rootValue.R) < 0.1);
 }
 
+void MCTS::UnitTestLeafRollouts()
+{
+    TEST_SIMULATOR testSimulator(2, 2, 0);
+    PARAMS params;
+    params.MaxDepth = 10;
+    params.LeafRollouts = 8;
+    MCTS mcts(testSimulator, params);
+    RC totalRewardCost;
+    const int numLeaves = 200;
+    for (int n = 0; n < numLeaves; ++n)
+    {
+        STATE* state = testSimulator.CreateStartState();
+        mcts.TreeDepth = 0;
+        totalRewardCost += mcts.Rollout(*state, params.LeafRollouts);
+        testSimulator.FreeState(state);
+    }
+    assert(mcts.StatRolloutDepth.GetCount() == numLeaves * params.LeafRollouts);
+    RC rootValue = totalRewardCost / numLeaves;
+    RC meanValue = testSimulator.MeanValue();
+    assert(fabs(meanValue.R - rootValue.R) < 0.1);
+}
+
+void MCTS::UnitTestTimeBudget()
+{
+    TEST_SIMULATOR testSimulator(3, 2, 3);
+    PARAMS params;
+    params.MaxDepth = 4;
+    params.NumSimulations = 1 << 30;
+    params.TimeBudget = 0.01;
+    params.c_hat = Infinity;
+    for (int threads = 1; threads <= 2; ++threads)
+    {
+        params.NumThreads = threads;
+        MCTS mcts(testSimulator, params);
+        TIMER timer;
+        mcts.SelectAction();
+        // Generous, as the machine may be loaded
+        assert(timer.Elapsed() < 1.0);
+        assert(mcts.GetSimulationsRun() > 0);
+        assert(mcts.GetSimulationsRun() < params.NumSimulations);
+    }
+}
+
+void MCTS::UnitTestConvergence()
+{
+    // Action 0 is plainly best, so the search should settle on it long
+    // before the simulations run out
+    TEST_SIMULATOR testSimulator(3, 2, 3);
+    PARAMS params;
+    params.MaxDepth = 4;
+    params.NumSimulations = 1 << 20;
+    params.StopInterval = 64;
+    params.c_hat = Infinity;
+    for (int threads = 1; threads <= 2; ++threads)
+    {
+        params.NumThreads = threads;
+        params.TreeParallel = threads > 1;
+        MCTS mcts(testSimulator, params);
+        Policy policy = mcts.SelectAction();
+        assert(mcts.GetSimulationsRun() < params.NumSimulations);
+        assert(mcts.GetSimulationsRun() >= params.StopInterval * params.StopChecks);
+        assert(policy.getMinCostAction() == 0 && policy.getMaxCostAction() == 0);
+    }
+}
+
+void MCTS::UnitTestPonder()
+{
+    TEST_SIMULATOR testSimulator(3, 2, 3);
+    PARAMS params;
+    params.MaxDepth = 4;
+    params.NumSimulations = 200;
+    params.Ponder = true;
+    params.c_hat = Infinity;
+    MCTS mcts(testSimulator, params);
+    mcts.SelectAction();
+    int visits = mcts.Root->Child(0).Child(0)->Value.GetCount();
+
+    // Pondering runs to NumSimulations if the environment is slow enough
+    mcts.StartPondering(0);
+    this_thread::sleep_for(chrono::milliseconds(200));
+    mcts.Update(0, 0, RC(1.0, 1.0));
+    assert(mcts.GetSimulationsPondered() > 0);
+    assert(mcts.Root->Value.GetCount() > visits);
+}
+
 void MCTS::UnitTestSearch(int depth)
 {
     TEST_SIMULATOR testSimulator(3, 2, depth);
@@ -690,4 +1225,171 @@ void MCTS::UnitTestSearch(int depth)
     assert(fabs(optimalValue.R - rootValue.R) < 0.1);
 }
 
+void MCTS::UnitTestParallelSearch(int depth, bool treeParallel)
+{
+    // Root parallel search is reproducible from the seed, as every worker
+    // is seeded from the master's generator
+    RandomSeed(depth);
+    TEST_SIMULATOR testSimulator(3, 2, depth);
+    PARAMS params;
+    params.MaxDepth = depth + 1;
+    params.NumSimulations = pow(10, depth + 1);
+    params.NumThreads = 4;
+    params.TreeParallel = treeParallel;
+    params.c_hat = Infinity;
+    MCTS mcts(testSimulator, params);
+    mcts.UCTSearch();
+    assert(mcts.Root->Value.GetCount() == params.NumSimulations);
+
+    // The merged root mean includes the exploration of every thread, and
+    // each root parallel tree explores on its own with a quarter of the
+    // budget, so it lies further below the optimum than in UnitTestSearch
+    // (0.16 for root and 0.13 for tree parallel search at depth 1)
+    RC rootValue = mcts.Root->Value.GetValue();
+    RC optimalValue = testSimulator.OptimalValue();
+    assert(fabs(optimalValue.R - rootValue.R) < 0.2);
+}
+
+void MCTS::UnitTestReuse()
+{
+    TEST_SIMULATOR testSimulator(3, 2, 2);
+    PARAMS params;
+    params.MaxDepth = 3;
+    params.NumSimulations = 1000;
+    params.c_hat = Infinity;
+    MCTS mcts(testSimulator, params);
+    mcts.UCTSearch();
+
+    // The matching subtree becomes the new root, keeping its statistics
+    int action = mcts.GreedyUCB(mcts.Root, false, false).sampleAction();
+    int observation = 0;
+    while (!mcts.Root->Child(action).Child(observation))
+        observation++;
+    VNODE* vnode = mcts.Root->Child(action).Child(observation);
+    int count = vnode->Value.GetCount();
+    int childCount = vnode->Child(0).Value.GetCount();
+    int numSamples = vnode->Beliefs().GetNumSamples();
+    assert(mcts.Update(action, observation, RC(0, 0)));
+    assert(mcts.Root->Value.GetCount() == count);
+    assert(mcts.Root->Child(0).Value.GetCount() == childCount);
+    assert(mcts.Root->Beliefs().GetNumSamples() == numSamples);
+
+    // Further search adds to the reused statistics
+    mcts.UCTSearch();
+    assert(mcts.Root->Value.GetCount() == count + params.NumSimulations);
+}
+
 //-----------------------------------------------------------------------------
+
+void MCTS::UnitTestIndependentSearches()
+{
+    // Searches of problems with different numbers of actions and
+    // observations run side by side, each finding its own optimum
+    TEST_SIMULATOR simulator1(3, 2, 2), simulator2(5, 7, 2);
+    PARAMS params;
+    params.MaxDepth = 3;
+    params.NumSimulations = 1000;
+    params.c_hat = Infinity;
+    params.TreeAlgorithm = 1;
+    params.ExplorationConstant = 0.5;
+    MCTS mcts1(simulator1, params), mcts2(simulator2, params);
+    mcts1.lambda = mcts2.lambda = 0;
+    thread thread2(&MCTS::UCTSearch, &mcts2);
+    mcts1.UCTSearch();
+    thread2.join();
+    assert(mcts1.Root->GetNumActions() == 3 && mcts2.Root->GetNumActions() == 5);
+    assert(fabs(simulator1.OptimalValue().R - mcts1.Root->Value.GetValue().R) < 0.1);
+    assert(fabs(simulator2.OptimalValue().R - mcts2.Root->Value.GetValue().R) < 0.1);
+}
+
+void MCTS::UnitTestParticleFilter()
+{
+    // The test simulator's observations are coin flips, so about half the
+    // particles explain each one
+    TEST_SIMULATOR testSimulator(3, 2, 3);
+    PARAMS params;
+    params.MaxDepth = 4;
+    params.NumSimulations = 200;
+    params.NumStartStates = 400;
+    params.c_hat = Infinity;
+    params.ParticleFilter = true;
+    params.ResampleThreshold = 0;
+    MCTS mcts(testSimulator, params);
+    mcts.UCTSearch();
+    assert(mcts.Root->Child(0).Child(0)->Beliefs().Empty());
+
+    // Without resampling the consistent particles keep their weights
+    assert(mcts.Update(0, 1, RC(1, 1)));
+    const BELIEF_STATE& beliefs = mcts.BeliefState();
+    assert(beliefs.GetNumSamples() > 150 && beliefs.GetNumSamples() < 250);
+    assert(beliefs.GetEffectiveSampleSize() == beliefs.GetNumSamples());
+    for (int i = 0; i < beliefs.GetNumSamples(); i++)
+        assert(safe_cast<const TEST_STATE*>(beliefs.GetSample(i))->Depth == 1);
+
+    // Resampling restores the particle budget
+    mcts.Params.ResampleThreshold = 0.5;
+    mcts.UCTSearch();
+    assert(mcts.Update(1, 0, RC(0, 0)));
+    assert(mcts.BeliefState().GetNumSamples() == params.NumStartStates);
+    assert(!mcts.BeliefState().Weighted());
+    for (int i = 0; i < mcts.BeliefState().GetNumSamples(); i++)
+        assert(safe_cast<const TEST_STATE*>(mcts.BeliefState().GetSample(i))->Depth == 2);
+
+    // With a thousand observations both particles are all but sure to be
+    // rejected, and are revived by local moves with their weights intact
+    TEST_SIMULATOR manyObservations(2, 1000, 3);
+    params.NumStartStates = 2;
+    params.ResampleThreshold = 0;
+    MCTS revived(manyObservations, params);
+    BELIEF_STATE& prior = revived.Root->Beliefs();
+    prior.Free(manyObservations);
+    prior.AddSample(manyObservations.CreateStartState(), 1);
+    prior.AddSample(manyObservations.CreateStartState(), 3);
+    RandomSeed(0);
+    assert(revived.Update(0, 999, RC(1, 1)));
+    assert(revived.BeliefState().GetNumSamples() == 2);
+    assert(revived.BeliefState().GetWeight(0) == 1 && revived.BeliefState().GetWeight(1) == 3);
+}
+
+//-----------------------------------------------------------------------------
+
+void MCTS::Benchmark(BENCHMARK& bench)
+{
+    // Action selection at synthetic nodes, cycling through enough of them
+    // that their statistics are not all in the L1 cache
+    const int numNodes = 256;
+    for (int numActions = 10; numActions <= 30; numActions += 10)
+    {
+        TEST_SIMULATOR testSimulator(numActions, 2, 1);
+        PARAMS params;
+        params.NumStartStates = 1;
+        params.c_hat = 0.5;
+        MCTS mcts(testSimulator, params);
+        mcts.lambda = 1;
+
+        RandomSeed(0);
+        vector<VNODE*> nodes;
+        for (int i = 0; i < numNodes; i++)
+        {
+            VNODE* vnode = mcts.ExpandNode(testSimulator.CreateStartState());
+            int total = 0;
+            for (int action = 0; action < numActions; action++)
+            {
+                int count = Random(4) == 0 ? 0 : Random(1, 200);
+                vnode->Child(action).Value.Set(count,
+                    RC(RandomDouble(0, 10), RandomDouble(0, 1)));
+                total += count;
+            }
+            vnode->Value.Set(total, RC(0, 0));
+            nodes.push_back(vnode);
+        }
+
+        ostringstream name;
+        name << "greedy_ucb/" << numActions << "_actions";
+        int next = 0;
+        bench.Run(name.str(), 1, [&]()
+        {
+            mcts.GreedyUCB(nodes[next++ % numNodes], true, true);
+        });
+    }
+}
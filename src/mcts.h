@@ -3,8 +3,13 @@
 
 #include "simulator.h"
 #include "node.h"
+#include "profile.h"
 #include "statistic.h"
+#include "timer.h"
 #include "utils.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 class Policy {
     // assume that the number of stochastic actions is not larger than 2. (since the number of cost types is 1).
@@ -63,6 +68,8 @@ public:
         }
     }
 
+    int getMinCostAction() { return minCostAction; }
+    int getMaxCostAction() { return maxCostAction; }
     double getProbMinCostAction() { return probMinCostAction; }
     double getProbMaxCostAction() { return probMaxCostAction; }
 private:
@@ -70,6 +77,8 @@ private:
     double probMinCostAction, probMaxCostAction;
 };
 
+class BENCHMARK;
+
 class MCTS
 {
 public:
@@ -94,6 +103,30 @@ public:
         double LambdaMax;
         double c_hat;
         int TreeAlgorithm;
+        int NumThreads;
+        bool TreeParallel;
+        int VirtualLoss;
+        bool ReuseTree;
+        int LeafRollouts;
+        // Seconds of search per decision, or 0 for no limit. NumSimulations
+        // still bounds the search when the budget is not reached.
+        double TimeBudget;
+        // Stop once the root policy is unchanged, to within StopTolerance in
+        // its mixing probability, over StopChecks checks made every
+        // StopInterval simulations (0 never stops early)
+        int StopInterval;
+        int StopChecks;
+        double StopTolerance;
+        // Keep searching below the chosen action between SelectAction and
+        // Update (needs ReuseTree)
+        bool Ponder;
+        // Update the root particles by importance weighting with the
+        // simulator's observation likelihood, instead of keeping those the
+        // search left below the real observation. The filter resamples
+        // NumStartStates particles when the effective sample size falls
+        // below ResampleThreshold of that, and replaces UseTransforms.
+        bool ParticleFilter;
+        double ResampleThreshold;
     };
 
     MCTS(const SIMULATOR& simulator, const PARAMS& params);
@@ -102,14 +135,26 @@ public:
     Policy SelectAction();
     bool Update(int action, int observation, RC rewardcost);
 
+    // Search the subtrees of the action being executed in the background,
+    // until the next Update or SelectAction
+    void StartPondering(int action);
+
     void UCTSearch();
     void RolloutSearch();
 
-    RC Rollout(STATE& state);
+    RC Rollout(STATE& state, int numRollouts = 1);
 
     const BELIEF_STATE& BeliefState() const { return Root->Beliefs(); }
     const HISTORY& GetHistory() const { return History; }
     const SIMULATOR::STATUS& GetStatus() const { return Status; }
+    int GetSimulationsRun() const { return SimulationsRun; }
+    int GetSimulationsPondered() const { return SimulationsPondered; }
+    // Tree nodes created since construction, by this search and its workers
+    int64_t GetNodesExpanded() const { return NodesExpanded; }
+    // Search time by phase since the last ClearProfile, including search
+    // workers and pondering (empty unless built with PROFILING)
+    const PROFILE& GetProfile() const { return Profile; }
+    void ClearProfile() { Profile.Clear(); }
     void ClearStatistics();
     void DisplayStatistics(std::ostream& ostr) const;
     void DisplayValue(int depth, std::ostream& ostr) const;
@@ -143,14 +188,25 @@ public:
     }
 
     static void UnitTest();
-    static void InitFastUCB(double exploration);
+    static void Benchmark(BENCHMARK& bench);
 
 private:
 
+    // Search worker over the master's root beliefs, either growing its own
+    // tree (root parallelisation) or sharing the master's (tree parallelisation)
+    MCTS(MCTS& master, bool shareTree);
+
     const SIMULATOR& Simulator;
     int TreeDepth, PeakTreeDepth;
     PARAMS Params;
     VNODE* Root;
+    // Nodes expanded since the last update, and those kept from before
+    ARENA Arena, SpareArena;
+    // Bytes held by the spare arena when it was last compacted
+    size_t CompactedBytes;
+    MCTS* TreeOwner;
+    bool SharedTree;
+    std::mutex SampleMutex;
     HISTORY History;
     SIMULATOR::STATUS Status;
     double lambda;
@@ -158,11 +214,46 @@ private:
     double c_hat;
     double initial_c_hat;
     int TreeAlgorithm;  // 0: CCPOMCP, 1: Baseline
+    TIMER SearchTimer;
+    int SimulationsRun;
+    int64_t NodesExpanded;
+    std::atomic<bool> Converged;
+    MCTS* Ponderer;
+    std::thread PonderThread;
+    std::atomic<bool> StopPonder;
+    int SimulationsPondered;
+    // Exploration / sqrt(n) for small action counts n, so that the UCB bonus
+    // is one lookup and a multiply (see SELECTION::BONUS)
+    std::vector<double> BonusTable;
+
+    // Working space of GreedyUCB and Rollout. Each search thread runs its
+    // own MCTS instance, so instances share nothing.
+    struct SCRATCH
+    {
+        std::vector<double> ActionQ, ActionC, ActionQplus, SelectQ;
+        std::vector<int> ActionN, BestA, Tied;
+        std::vector<STATE*> States;
+        std::vector<RC> Returns;
+        std::vector<int> Steps;
+    };
+    mutable SCRATCH Scratch;
+
+    // Root policy at the last convergence check, and the number of checks
+    // in a row that have found it unchanged
+    struct CONVERGENCE
+    {
+        CONVERGENCE() : StableChecks(-1) { }
+
+        int MinCostAction, MaxCostAction;
+        double ProbMinCostAction;
+        int StableChecks;
+    };
 
     STATISTIC StatTreeDepth;
     STATISTIC StatRolloutDepth;
     STATISTIC StatTotalReward;
     STATISTIC StatTotalCost;
+    mutable PROFILE Profile;
 
     Policy GreedyUCB(VNODE* vnode, bool ucb, bool stochastic) const;
     int SelectRandom() const;
@@ -172,21 +263,37 @@ private:
     VNODE* ExpandNode(const STATE* state);
     void AddSample(VNODE* node, const STATE& state);
     void AddTransforms(VNODE* root, BELIEF_STATE& beliefs);
+    void FilterBeliefs(int action, int observation, BELIEF_STATE& beliefs);
     STATE* CreateTransform() const;
     void Resample(BELIEF_STATE& beliefs);
     RC Simulate(const BELIEF_STATE &beliefs, int iteration);
+    void ParallelUCTSearch();
+    int RunSimulations(const BELIEF_STATE& beliefs, int numSimulations);
+    bool OutOfTime(int numSimulations) const;
+    bool HasConverged(int numSimulations, CONVERGENCE& convergence);
+    void Ponder(int action, uint64_t seed);
+    void StopPondering();
+    void SearchWorker(const BELIEF_STATE& beliefs, int numSimulations, uint64_t seed);
+    void MergeRoot(MCTS& worker);
 
-    // Fast lookup table for UCB
-    static const int UCB_N = 10000, UCB_n = 100;
-    static double UCB[UCB_N][UCB_n];
-    static bool InitialisedFastUCB;
+    // Simulations between checks of the time budget
+    static const int TimeCheckInterval = 8;
 
-    double FastUCB(int N, int n, double logN) const;
+    // Entries in the bonus table (8 KB)
+    static const int BonusTableSize = 1024;
 
     static void UnitTestGreedy();
     static void UnitTestUCB();
     static void UnitTestRollout();
+    static void UnitTestLeafRollouts();
+    static void UnitTestTimeBudget();
+    static void UnitTestConvergence();
+    static void UnitTestPonder();
     static void UnitTestSearch(int depth);
+    static void UnitTestParallelSearch(int depth, bool treeParallel);
+    static void UnitTestReuse();
+    static void UnitTestIndependentSearches();
+    static void UnitTestParticleFilter();
 };
 
 #endif // MCTS_H
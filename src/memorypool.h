@@ -1,8 +1,10 @@
 #ifndef MEMORY_POOL_H
 #define MEMORY_POOL_H
 
+#include <assert.h>
 #include <vector>
 #include <ostream>
+#include <mutex>
 
 class MEMORY_OBJECT
 {
@@ -17,13 +19,72 @@ private:
     bool Allocated;
 };
 
+//----------------------------------------------------------------------------
+// Small index of the calling thread, unique among the threads alive, so that
+// pools can keep a free list per thread. An index is returned for reuse when
+// its thread exits. Threads beyond MaxSlots all get MaxSlots.
+
+class THREAD_SLOT
+{
+public:
+
+    static const int MaxSlots = 64;
+
+    static int Get()
+    {
+        static thread_local THREAD_SLOT slot;
+        return slot.Index;
+    }
+
+private:
+
+    THREAD_SLOT()
+    {
+        std::lock_guard<std::mutex> lock(Mutex());
+        std::vector<bool>& used = Used();
+        for (Index = 0; Index < MaxSlots && used[Index]; Index++)
+            ;
+        if (Index < MaxSlots)
+            used[Index] = true;
+    }
+
+    ~THREAD_SLOT()
+    {
+        std::lock_guard<std::mutex> lock(Mutex());
+        if (Index < MaxSlots)
+            Used()[Index] = false;
+    }
+
+    static std::mutex& Mutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::vector<bool>& Used()
+    {
+        static std::vector<bool> used(MaxSlots, false);
+        return used;
+    }
+
+    int Index;
+};
+
+//----------------------------------------------------------------------------
+// Pool of objects allocated in chunks. Each thread allocates from and frees
+// to its own free list without locking. The lists trade objects with a
+// shared list, under a lock, a chunk's worth at a time: an empty list takes
+// a batch back, or a new chunk if there is none, and a list grown beyond two
+// batches gives one up, so that threads freeing what others allocate do not
+// hoard memory. A thread that exits leaves its list to the next thread given
+// its slot.
+
 template <class T>
 class MEMORY_POOL
 {
 public:
 
     MEMORY_POOL()
-    : NumAllocated(0)
     {
     }
 
@@ -44,36 +105,53 @@ public:
         Free(obj);
     }
 
-    T* Allocate() 
-    { 
-        if (FreeList.empty())
-            NewChunk();
-        T* obj = FreeList.back();
-        FreeList.pop_back();
-        assert(!obj->IsAllocated());
-        obj->SetAllocated();
-        NumAllocated++;
-        return obj;
+    // Allocate and Free may be called concurrently by parallel search threads
+    T* Allocate()
+    {
+        int slot = THREAD_SLOT::Get();
+        if (slot == THREAD_SLOT::MaxSlots)
+        {
+            std::lock_guard<std::mutex> lock(Mutex);
+            return Take(Locals[slot]);
+        }
+        return Take(Locals[slot]);
     }
-    
-    void Free(T* obj) 
-    { 
-        assert(obj->IsAllocated());
-        obj->ClearAllocated();
-        FreeList.push_back(obj);
-        NumAllocated--;
+
+    void Free(T* obj)
+    {
+        int slot = THREAD_SLOT::Get();
+        if (slot == THREAD_SLOT::MaxSlots)
+        {
+            std::lock_guard<std::mutex> lock(Mutex);
+            Give(Locals[slot], obj);
+            return;
+        }
+        Give(Locals[slot], obj);
     }
-    
+
+    // Only while no other thread uses the pool
     void DeleteAll()
     {
+        std::lock_guard<std::mutex> lock(Mutex);
         for (ChunkIterator i_chunk = Chunks.begin(); i_chunk != Chunks.end(); ++i_chunk)
             delete *i_chunk;
         Chunks.clear();
         FreeList.clear();
-        NumAllocated = 0;
+        for (int slot = 0; slot <= THREAD_SLOT::MaxSlots; slot++)
+        {
+            Locals[slot].FreeList.clear();
+            Locals[slot].NumAllocated = 0;
+        }
+    }
+
+    // Exact only while no other thread uses the pool
+    int GetNumAllocated() const
+    {
+        int numAllocated = 0;
+        for (int slot = 0; slot <= THREAD_SLOT::MaxSlots; slot++)
+            numAllocated += Locals[slot].NumAllocated;
+        return numAllocated;
     }
-    
-    int GetNumAllocated() const { return NumAllocated; }
 
 private:
 
@@ -83,6 +161,60 @@ private:
         T Objects[Size];
     };
 
+    // Objects allocated by a thread may be freed by another, so a list's
+    // count can go negative, but the counts sum to the objects in use.
+    // Each list has its own cache lines.
+    struct alignas(64) LOCAL
+    {
+        LOCAL() : NumAllocated(0) { }
+
+        std::vector<T*> FreeList;
+        int NumAllocated;
+    };
+
+    T* Take(LOCAL& local)
+    {
+        if (local.FreeList.empty())
+            Refill(local);
+        T* obj = local.FreeList.back();
+        local.FreeList.pop_back();
+        assert(!obj->IsAllocated());
+        obj->SetAllocated();
+        local.NumAllocated++;
+        return obj;
+    }
+
+    void Give(LOCAL& local, T* obj)
+    {
+        assert(obj->IsAllocated());
+        obj->ClearAllocated();
+        local.FreeList.push_back(obj);
+        local.NumAllocated--;
+        if ((int) local.FreeList.size() > 2 * CHUNK::Size)
+            Release(local);
+    }
+
+    void Refill(LOCAL& local)
+    {
+        std::unique_lock<std::mutex> lock(Mutex, std::defer_lock);
+        if (&local != &Locals[THREAD_SLOT::MaxSlots])
+            lock.lock();
+        if (FreeList.empty())
+            NewChunk();
+        int batch = (int) FreeList.size() < CHUNK::Size ? (int) FreeList.size() : CHUNK::Size;
+        local.FreeList.insert(local.FreeList.end(), FreeList.end() - batch, FreeList.end());
+        FreeList.resize(FreeList.size() - batch);
+    }
+
+    void Release(LOCAL& local)
+    {
+        std::unique_lock<std::mutex> lock(Mutex, std::defer_lock);
+        if (&local != &Locals[THREAD_SLOT::MaxSlots])
+            lock.lock();
+        FreeList.insert(FreeList.end(), local.FreeList.end() - CHUNK::Size, local.FreeList.end());
+        local.FreeList.resize(local.FreeList.size() - CHUNK::Size);
+    }
+
     void NewChunk()
     {
         CHUNK* chunk = new CHUNK;
@@ -94,9 +226,12 @@ private:
         }
     }
 
+    // Chunks and the shared free list are guarded by Mutex, as is the extra
+    // list of the threads without a slot of their own
     std::vector<CHUNK*> Chunks;
     std::vector<T*> FreeList;
-    int NumAllocated;
+    LOCAL Locals[THREAD_SLOT::MaxSlots + 1];
+    std::mutex Mutex;
     typedef typename std::vector<CHUNK*>::iterator ChunkIterator;
 };
 
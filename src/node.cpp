@@ -1,22 +1,13 @@
 #include "node.h"
 #include "history.h"
 #include "utils.h"
+#include <new>
+#include <string.h>
 
 using namespace std;
 
 //-----------------------------------------------------------------------------
 
-int QNODE::NumChildren = 0;
-
-void QNODE::Initialise()
-{
-    assert(NumChildren);
-    Children.resize(NumChildren);
-    for (int observation = 0; observation < QNODE::NumChildren; observation++)
-        Children[observation] = 0;
-    AlphaData.AlphaSum.clear();
-}
-
 void QNODE::DisplayValue(HISTORY& history, int maxDepth, ostream& ostr) const
 {
     history.Display(ostr);
@@ -55,45 +46,130 @@ void QNODE::DisplayPolicy(double lambda, HISTORY& history, int maxDepth, ostream
 
 //-----------------------------------------------------------------------------
 
-MEMORY_POOL<VNODE> VNODE::VNodePool;
+// Arrays within a node's block start on the arena's 16-byte alignment
+static size_t Padded(size_t bytes)
+{
+    return (bytes + 15) & ~(size_t) 15;
+}
 
-int VNODE::NumChildren = 0;
+template<class T>
+static T* Carve(char*& block, int count)
+{
+    T* array = (T*) block;
+    block += Padded(sizeof(T) * count);
+    return array;
+}
+
+VNODE* VNODE::Allocate(ARENA& arena, int numActions, int numObservations, bool alpha)
+{
+    assert(numActions && numObservations);
+    size_t bytes = Padded(sizeof(VNODE)) + ArrayBytes(numActions, numObservations);
+    if (alpha)
+        bytes += Padded(sizeof(ALPHA) * numActions);
+
+    char* block = (char*) arena.Allocate(bytes);
+    VNODE* vnode = new (Carve<VNODE>(block, 1)) VNODE;
+    vnode->NumChildren = numActions;
+    vnode->NumObservations = numObservations;
+    vnode->Counts = Carve<int>(block, numActions);
+    vnode->TotalR = Carve<double>(block, numActions);
+    vnode->TotalC = Carve<double>(block, numActions);
+    vnode->VirtualLoss = Carve<int>(block, numActions);
+    vnode->AMAF = Carve<VALUE<double> >(block, numActions);
+    vnode->Children = Carve<VNODE*>(block, numActions * numObservations);
+    vnode->Alpha = alpha ? Carve<ALPHA>(block, numActions) : 0;
+    return vnode;
+}
 
-void VNODE::Initialise()
+// Bytes of the per-action arrays, which follow each VNODE contiguously
+// from Counts to the end of Children
+size_t VNODE::ArrayBytes(int numActions, int numObservations)
 {
-    assert(NumChildren);
-    Children.resize(VNODE::NumChildren);
-    for (int action = 0; action < VNODE::NumChildren; action++)
-        Children[action].Initialise();
+    return 2 * Padded(sizeof(int) * numActions)
+        + 2 * Padded(sizeof(double) * numActions)
+        + Padded(sizeof(VALUE<double>) * numActions)
+        + Padded(sizeof(VNODE*) * numActions * numObservations);
 }
 
-VNODE* VNODE::Create()
+VNODE* VNODE::Create(ARENA& arena, int numActions, int numObservations, bool alpha)
 {
-    VNODE* vnode = VNodePool.Allocate();
-    vnode->Initialise();
+    VNODE* vnode = Allocate(arena, numActions, numObservations, alpha);
+    // All-zero bytes are zero counts, zero totals and null children
+    memset(vnode->Counts, 0, ArrayBytes(numActions, numObservations));
+    if (alpha)
+        for (int action = 0; action < numActions; action++)
+            new (&vnode->Alpha[action]) ALPHA;
     return vnode;
 }
 
-void VNODE::Free(VNODE* vnode, const SIMULATOR& simulator)
+void VNODE::Destroy(VNODE* vnode, const SIMULATOR& simulator)
 {
     vnode->BeliefState.Free(simulator);
-    VNodePool.Free(vnode);
-    for (int action = 0; action < VNODE::NumChildren; action++)
-        for (int observation = 0; observation < QNODE::NumChildren; observation++)
-            if (vnode->Child(action).Child(observation))
-                Free(vnode->Child(action).Child(observation), simulator);
+    if (vnode->Alpha)
+        for (int action = 0; action < vnode->NumChildren; action++)
+            vnode->Alpha[action].~ALPHA();
+    vnode->~VNODE();
+}
+
+void VNODE::DestroyAll(VNODE* vnode, const SIMULATOR& simulator)
+{
+    for (int i = 0; i < vnode->NumChildren * vnode->NumObservations; i++)
+        if (vnode->Children[i])
+            DestroyAll(vnode->Children[i], simulator);
+    Destroy(vnode, simulator);
+}
+
+void VNODE::FreeTree(VNODE* root, const SIMULATOR& simulator, ARENA& arena)
+{
+    if (root->Alpha)
+        DestroyAll(root, simulator);
+    else
+    {
+        for (int i = 0; i < root->NumChildren * root->NumObservations; i++)
+            if (root->Children[i])
+                Destroy(root->Children[i], simulator);
+        Destroy(root, simulator);
+    }
+    arena.Reset();
+}
+
+void VNODE::Prune(VNODE* root, const VNODE* keep, const SIMULATOR& simulator)
+{
+    for (int i = 0; i < root->NumChildren * root->NumObservations; i++)
+    {
+        VNODE* child = root->Children[i];
+        if (!child || child == keep)
+            continue;
+        if (root->Alpha)
+            DestroyAll(child, simulator);
+        else
+            Destroy(child, simulator);
+    }
+    Destroy(root, simulator);
 }
 
-void VNODE::FreeAll()
+VNODE* VNODE::Relocate(VNODE* vnode, ARENA& arena, const SIMULATOR& simulator)
 {
-	VNodePool.DeleteAll();
+    const int numActions = vnode->NumChildren;
+    VNODE* moved = Allocate(arena, numActions, vnode->NumObservations, vnode->Alpha != 0);
+    moved->Value = vnode->Value;
+    memcpy(moved->Counts, vnode->Counts, ArrayBytes(numActions, vnode->NumObservations));
+    if (vnode->Alpha)
+        for (int action = 0; action < numActions; action++)
+            new (&moved->Alpha[action]) ALPHA(vnode->Alpha[action]);
+    moved->BeliefState.Move(vnode->BeliefState);
+    for (int i = 0; i < numActions * vnode->NumObservations; i++)
+        if (vnode->Children[i])
+            moved->Children[i] = Relocate(vnode->Children[i], arena, simulator);
+    Destroy(vnode, simulator);
+    return moved;
 }
 
 void VNODE::SetChildren(int count, RC value)
 {
     for (int action = 0; action < NumChildren; action++)
     {
-        QNODE& qnode = Children[action];
+        QNODE qnode = Child(action);
         qnode.Value.Set(count, value);
         qnode.AMAF.Set(count, value);
     }
@@ -107,7 +183,7 @@ void VNODE::DisplayValue(HISTORY& history, int maxDepth, ostream& ostr) const
     for (int action = 0; action < NumChildren; action++)
     {
         history.Add(action);
-        Children[action].DisplayValue(history, maxDepth, ostr);
+        Child(action).DisplayValue(history, maxDepth, ostr);
         history.Pop();
     }
 }
@@ -121,7 +197,8 @@ void VNODE::DisplayPolicy(double lambda, HISTORY& history, int maxDepth, ostream
     int besta = -1;
     for (int action = 0; action < NumChildren; action++)
     {
-        double scalarizedValue = Children[action].Value.GetValue().R - lambda * Children[action].Value.GetValue().C;
+        RC value = Child(action).Value.GetValue();
+        double scalarizedValue = value.R - lambda * value.C;
         if (scalarizedValue > bestq)
         {
             besta = action;
@@ -132,7 +209,7 @@ void VNODE::DisplayPolicy(double lambda, HISTORY& history, int maxDepth, ostream
     if (besta != -1)
     {
         history.Add(besta);
-        Children[besta].DisplayPolicy(lambda, history, maxDepth, ostr);
+        Child(besta).DisplayPolicy(lambda, history, maxDepth, ostr);
         history.Pop();
     }
 }
@@ -1,6 +1,7 @@
 #ifndef NODE_H
 #define NODE_H
 
+#include "arena.h"
 #include "beliefstate.h"
 #include "utils.h"
 #include <iostream>
@@ -76,6 +77,19 @@ public:
         Total += totalReward * weight;
     }
 
+    // Thread-safe variants of Add, for trees searched by several threads
+    void AtomicAdd(RC totalReward)
+    {
+        AtomicAdd(totalReward, 1);
+    }
+
+    void AtomicAdd(RC totalReward, COUNT weight)
+    {
+        UTILS::AtomicAdd(Total.R, totalReward.R * weight);
+        UTILS::AtomicAdd(Total.C, totalReward.C * weight);
+        UTILS::AtomicAdd(Count, weight);
+    }
+
     RC GetValue() const
     {
         return Count == 0 ? Total : Total / Count;
@@ -86,6 +100,13 @@ public:
         return Count;
     }
 
+    // Accumulate statistics gathered by another search tree
+    void Merge(const VALUE<COUNT>& value)
+    {
+        Count += value.Count;
+        Total += value.Total;
+    }
+
 private:
 
     COUNT Count;
@@ -94,63 +115,188 @@ private:
 
 //-----------------------------------------------------------------------------
 
+// Statistics of one action, stored in the per-action arrays of its VNODE
+class ACTION_VALUE
+{
+public:
+
+    ACTION_VALUE(int* count, double* totalR, double* totalC)
+    :   Count(count), TotalR(totalR), TotalC(totalC)
+    { }
+
+    void Set(int count, RC value)
+    {
+        *Count = count;
+        *TotalR = value.R * count;
+        *TotalC = value.C * count;
+    }
+
+    void Add(RC totalReward)
+    {
+        *Count += 1;
+        *TotalR += totalReward.R;
+        *TotalC += totalReward.C;
+    }
+
+    // Thread-safe variant of Add, for trees searched by several threads
+    void AtomicAdd(RC totalReward)
+    {
+        UTILS::AtomicAdd(*TotalR, totalReward.R);
+        UTILS::AtomicAdd(*TotalC, totalReward.C);
+        UTILS::AtomicAdd(*Count, 1);
+    }
+
+    // Accumulate statistics gathered by another search tree
+    void Merge(const ACTION_VALUE& value)
+    {
+        *Count += *value.Count;
+        *TotalR += *value.TotalR;
+        *TotalC += *value.TotalC;
+    }
+
+    RC GetValue() const
+    {
+        return *Count == 0 ? RC(*TotalR, *TotalC) : RC(*TotalR / *Count, *TotalC / *Count);
+    }
+
+    int GetCount() const
+    {
+        return *Count;
+    }
+
+private:
+
+    int* Count;
+    double* TotalR;
+    double* TotalC;
+};
+
+//-----------------------------------------------------------------------------
+// An action of a VNODE. QNODE is a lightweight view of the VNODE's
+// per-action arrays, created on demand by VNODE::Child.
+
 class QNODE
 {
 public:
 
-    VALUE<int> Value;
-    VALUE<double> AMAF;
+    QNODE(VNODE* vnode, int action);
+
+    ACTION_VALUE Value;
+    VALUE<double>& AMAF;
 
-    void Initialise();
+    VNODE*& Child(int c) const { return Children[c]; }
+    VNODE* LoadChild(int c) const { return __atomic_load_n(&Children[c], __ATOMIC_ACQUIRE); }
+    VNODE* InstallChild(int c, VNODE* vnode) const;
+    ALPHA& Alpha() const { assert(AlphaData); return *AlphaData; }
 
-    VNODE*& Child(int c) { return Children[c]; }
-    VNODE* Child(int c) const { return Children[c]; }
-    ALPHA& Alpha() { return AlphaData; }
-    const ALPHA& Alpha() const { return AlphaData; }
+    // Number of descents currently in progress through this action
+    int GetVirtualLoss() const { return __atomic_load_n(&VirtualLoss, __ATOMIC_RELAXED); }
+    void AddVirtualLoss(int loss) const { __atomic_add_fetch(&VirtualLoss, loss, __ATOMIC_RELAXED); }
 
     void DisplayValue(HISTORY& history, int maxDepth, std::ostream& ostr) const;
     void DisplayPolicy(double lambda, HISTORY& history, int maxDepth, std::ostream& ostr) const;
 
-    static int NumChildren;
-
 private:
 
-    std::vector<VNODE*> Children;
-    ALPHA AlphaData;
-
-friend class VNODE;
+    VNODE** Children;
+    ALPHA* AlphaData;
+    int& VirtualLoss;
+    // Number of observations
+    int NumChildren;
 };
 
+// Install a lazily expanded child unless another thread got there first.
+// Returns the child that ends up in the slot.
+inline VNODE* QNODE::InstallChild(int c, VNODE* vnode) const
+{
+    VNODE* expected = 0;
+    if (__atomic_compare_exchange_n(&Children[c], &expected, vnode, false,
+            __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+        return vnode;
+    return expected;
+}
+
 //-----------------------------------------------------------------------------
 
-class VNODE : public MEMORY_OBJECT
+// Nodes and their per-action arrays are carved from one ARENA block, so a
+// whole search tree is discarded by resetting its arena. Each node records
+// its numbers of actions and observations, so trees of different problems
+// can coexist in one process.
+
+class VNODE
 {
 public:
 
     VALUE<int> Value;
 
-    void Initialise();
-    static VNODE* Create();
-    static void Free(VNODE* vnode, const SIMULATOR& simulator);
-    static void FreeAll();
-
-    QNODE& Child(int c) { return Children[c]; }
-    const QNODE& Child(int c) const { return Children[c]; }
+    // Alpha vectors are only allocated for simulators that use them
+    static VNODE* Create(ARENA& arena, int numActions, int numObservations, bool alpha);
+    // Release the particles and alpha vectors held by a node. Its memory
+    // stays in the arena until the arena is reset.
+    static void Destroy(VNODE* vnode, const SIMULATOR& simulator);
+    // Release a whole tree and reset its arena. Only the root and its
+    // depth-one children hold particles, so unless the simulator uses alpha
+    // vectors no other node is visited.
+    static void FreeTree(VNODE* root, const SIMULATOR& simulator, ARENA& arena);
+    // Release everything a tree holds except the subtree of keep, a child of
+    // root, leaving the memory in its arenas. Visits the same nodes as
+    // FreeTree.
+    static void Prune(VNODE* root, const VNODE* keep, const SIMULATOR& simulator);
+    // Move a subtree into another arena with its statistics and particles,
+    // and return its new root. The old copy is released, but its memory
+    // stays in its arenas.
+    static VNODE* Relocate(VNODE* vnode, ARENA& arena, const SIMULATOR& simulator);
+
+    QNODE Child(int c) { return QNODE(this, c); }
+    const QNODE Child(int c) const { return QNODE(const_cast<VNODE*>(this), c); }
     BELIEF_STATE& Beliefs() { return BeliefState; }
     const BELIEF_STATE& Beliefs() const { return BeliefState; }
 
+    // Contiguous per-action statistics, for scanning all actions at once
+    const int* GetCounts() const { return Counts; }
+    const double* GetTotalR() const { return TotalR; }
+    const double* GetTotalC() const { return TotalC; }
+    const int* GetVirtualLosses() const { return VirtualLoss; }
+    int GetNumActions() const { return NumChildren; }
+    int GetNumObservations() const { return NumObservations; }
+
     void SetChildren(int count, RC value);
 
     void DisplayValue(HISTORY& history, int maxDepth, std::ostream& ostr) const;
     void DisplayPolicy(double lambda, HISTORY& history, int maxDepth, std::ostream& ostr) const;
 
-    static int NumChildren;
-
 private:
 
-    std::vector<QNODE> Children;
+    VNODE() { }
+    static VNODE* Allocate(ARENA& arena, int numActions, int numObservations, bool alpha);
+    static size_t ArrayBytes(int numActions, int numObservations);
+    static void DestroyAll(VNODE* vnode, const SIMULATOR& simulator);
+
+    // Number of actions, and of observations after each action
+    int NumChildren, NumObservations;
+
+    int* Counts;
+    double* TotalR;
+    double* TotalC;
+    int* VirtualLoss;
+    VALUE<double>* AMAF;
+    ALPHA* Alpha;
+    // Observation children of all actions, indexed by
+    // action * NumObservations + observation
+    VNODE** Children;
     BELIEF_STATE BeliefState;
-    static MEMORY_POOL<VNODE> VNodePool;
+
+friend class QNODE;
 };
 
+inline QNODE::QNODE(VNODE* vnode, int action)
+:   Value(&vnode->Counts[action], &vnode->TotalR[action], &vnode->TotalC[action]),
+    AMAF(vnode->AMAF[action]),
+    Children(&vnode->Children[action * vnode->NumObservations]),
+    AlphaData(vnode->Alpha ? &vnode->Alpha[action] : 0),
+    VirtualLoss(vnode->VirtualLoss[action]),
+    NumChildren(vnode->NumObservations)
+{
+}
+
 #endif // NODE_H
@@ -0,0 +1,89 @@
+#include "profile.h"
+#include <assert.h>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+void PROFILE::Clear()
+{
+    for (int phase = 0; phase < NUM_PHASES; phase++)
+    {
+        Nanoseconds[phase] = 0;
+        Calls[phase] = 0;
+    }
+    NodePoolBytes = 0;
+}
+
+void PROFILE::Merge(const PROFILE& profile)
+{
+    for (int phase = 0; phase < NUM_PHASES; phase++)
+    {
+        Nanoseconds[phase] += profile.Nanoseconds[phase];
+        Calls[phase] += profile.Calls[phase];
+    }
+}
+
+void PROFILE::Write(ostream& ostr) const
+{
+    ostr << "\"phases\":{";
+    for (int phase = 0; phase < NUM_PHASES; phase++)
+    {
+        if (phase > 0)
+            ostr << ",";
+        ostr << "\"" << Name((PHASE) phase) << "\":{\"ns\":" << Nanoseconds[phase]
+            << ",\"calls\":" << Calls[phase] << "}";
+    }
+    ostr << "},\"node_pool_bytes\":" << NodePoolBytes;
+}
+
+const char* PROFILE::Name(PHASE phase)
+{
+    static const char* names[NUM_PHASES] =
+    {
+        "greedy_ucb",
+        "tree_step",
+        "rollout_step",
+        "create_sample",
+        "copy_state",
+        "expand_node",
+        "reuse_subtree",
+        "free_tree",
+        "add_transforms",
+        "filter_beliefs"
+    };
+    return names[phase];
+}
+
+void PROFILE::UnitTest()
+{
+    PROFILE profile, worker;
+    CLOCK::time_point start = CLOCK::now() - chrono::microseconds(5);
+    profile.Add(GREEDY_UCB, start);
+    profile.Add(GREEDY_UCB, start);
+    worker.Add(GREEDY_UCB, start);
+    worker.Add(ROLLOUT_STEP, start, 10);
+    {
+        PROFILE_TIMER timer(worker, FREE_TREE);
+    }
+    profile.Merge(worker);
+    profile.SetNodePoolBytes(4096);
+    assert(profile.GetCalls(GREEDY_UCB) == 3);
+    assert(profile.GetNanoseconds(GREEDY_UCB) >= 15000);
+    assert(profile.GetCalls(ROLLOUT_STEP) == 10);
+    assert(profile.GetCalls(FREE_TREE) == 1);
+    assert(profile.GetCalls(TREE_STEP) == 0 && profile.GetNanoseconds(TREE_STEP) == 0);
+
+    ostringstream json;
+    profile.Write(json);
+    string line = json.str();
+    string head = "\"phases\":{\"greedy_ucb\":{\"ns\":";
+    string tail = "},\"node_pool_bytes\":4096";
+    assert(line.compare(0, head.size(), head) == 0);
+    assert(line.compare(line.size() - tail.size(), tail.size(), tail) == 0);
+    assert(line.find("\"rollout_step\":{\"ns\":") != string::npos);
+    assert(line.find("\"tree_step\":{\"ns\":0,\"calls\":0}") != string::npos);
+
+    profile.Clear();
+    assert(profile.GetCalls(GREEDY_UCB) == 0 && profile.GetNanoseconds(ROLLOUT_STEP) == 0);
+}
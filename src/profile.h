@@ -0,0 +1,105 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <chrono>
+#include <iostream>
+#include <stdint.h>
+
+//----------------------------------------------------------------------------
+// Time and call counts of the phases of a search, kept by each MCTS
+// instance. The timers are compiled in only when PROFILING is defined
+// (make PROFILE=1); otherwise PROFILE_SCOPE, PROFILE_START and PROFILE_STOP
+// expand to nothing, and the counters stay at zero.
+
+class PROFILE
+{
+public:
+
+    enum PHASE
+    {
+        GREEDY_UCB,
+        TREE_STEP,
+        ROLLOUT_STEP,   // calls are steps, time includes the rollout policy
+        CREATE_SAMPLE,
+        COPY_STATE,
+        EXPAND_NODE,
+        REUSE_SUBTREE,
+        FREE_TREE,
+        ADD_TRANSFORMS,
+        FILTER_BELIEFS,
+        NUM_PHASES
+    };
+
+    typedef std::chrono::steady_clock CLOCK;
+
+    PROFILE() { Clear(); }
+
+    void Clear();
+    void Add(PHASE phase, CLOCK::time_point start, int64_t calls = 1)
+    {
+        Nanoseconds[phase] += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            CLOCK::now() - start).count();
+        Calls[phase] += calls;
+    }
+    // Accumulate the counters of a search worker
+    void Merge(const PROFILE& profile);
+
+    // Bytes of tree nodes at the end of the last search
+    void SetNodePoolBytes(size_t bytes) { NodePoolBytes = bytes; }
+
+    int64_t GetNanoseconds(PHASE phase) const { return Nanoseconds[phase]; }
+    int64_t GetCalls(PHASE phase) const { return Calls[phase]; }
+
+    // JSON members "phases" and "node_pool_bytes", without enclosing braces
+    void Write(std::ostream& ostr) const;
+
+    static const char* Name(PHASE phase);
+    static void UnitTest();
+
+private:
+
+    int64_t Nanoseconds[NUM_PHASES];
+    int64_t Calls[NUM_PHASES];
+    size_t NodePoolBytes;
+};
+
+// Times the rest of the enclosing scope as one call of a phase
+class PROFILE_TIMER
+{
+public:
+
+    PROFILE_TIMER(PROFILE& profile, PROFILE::PHASE phase)
+    :   Profile(profile), Phase(phase), Start(PROFILE::CLOCK::now())
+    { }
+
+    ~PROFILE_TIMER()
+    {
+        Profile.Add(Phase, Start);
+    }
+
+private:
+
+    PROFILE& Profile;
+    PROFILE::PHASE Phase;
+    PROFILE::CLOCK::time_point Start;
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+
+#ifdef PROFILING
+#define PROFILE_SCOPE(profile, phase) \
+    PROFILE_TIMER PROFILE_CONCAT(profileTimer, __LINE__)((profile), PROFILE::phase)
+#define PROFILE_START(start) \
+    PROFILE::CLOCK::time_point start = PROFILE::CLOCK::now()
+#define PROFILE_STOP(profile, phase, start, calls) \
+    (profile).Add(PROFILE::phase, (start), (calls))
+#else
+#define PROFILE_SCOPE(profile, phase)
+#define PROFILE_START(start)
+#define PROFILE_STOP(profile, phase, start, calls)
+#endif
+
+//----------------------------------------------------------------------------
+
+#endif // PROFILE_H
@@ -0,0 +1,152 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <stdint.h>
+
+//-----------------------------------------------------------------------------
+// Fast pseudo-random generators with explicit seeding and independent streams.
+// Both share the same interface, so either can back the UTILS random
+// functions (define RANDOM_PCG to select PCG32).
+
+inline uint64_t SplitMix64(uint64_t& x)
+{
+    uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+//-----------------------------------------------------------------------------
+// xoshiro256** (Blackman and Vigna)
+
+class XOSHIRO256
+{
+public:
+
+    typedef uint64_t result_type;
+
+    XOSHIRO256(uint64_t seed = 0)
+    {
+        Seed(seed);
+    }
+
+    void Seed(uint64_t seed)
+    {
+        for (int i = 0; i < 4; i++)
+            S[i] = SplitMix64(seed);
+    }
+
+    uint64_t Next()
+    {
+        uint64_t result = Rotl(S[1] * 5, 7) * 9;
+        uint64_t t = S[1] << 17;
+        S[2] ^= S[0];
+        S[3] ^= S[1];
+        S[1] ^= S[2];
+        S[0] ^= S[3];
+        S[2] ^= t;
+        S[3] = Rotl(S[3], 45);
+        return result;
+    }
+
+    // Advance 2^128 steps, to the start of the next non-overlapping stream
+    void Jump()
+    {
+        static const uint64_t JUMP[4] =
+        {
+            0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+            0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL
+        };
+
+        uint64_t s[4] = { 0, 0, 0, 0 };
+        for (int i = 0; i < 4; i++)
+        {
+            for (int b = 0; b < 64; b++)
+            {
+                if (JUMP[i] & (1ULL << b))
+                    for (int j = 0; j < 4; j++)
+                        s[j] ^= S[j];
+                Next();
+            }
+        }
+        for (int j = 0; j < 4; j++)
+            S[j] = s[j];
+    }
+
+    // Standard uniform random bit generator interface
+    static constexpr uint64_t min() { return 0; }
+    static constexpr uint64_t max() { return ~0ULL; }
+    uint64_t operator()() { return Next(); }
+
+private:
+
+    static uint64_t Rotl(uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    uint64_t S[4];
+};
+
+//-----------------------------------------------------------------------------
+// PCG32 (O'Neill), two outputs combined per 64-bit draw
+
+class PCG32
+{
+public:
+
+    typedef uint64_t result_type;
+
+    PCG32(uint64_t seed = 0)
+    {
+        Seed(seed);
+    }
+
+    void Seed(uint64_t seed)
+    {
+        Inc = (SplitMix64(seed) << 1) | 1;
+        State = 0;
+        Next32();
+        State += SplitMix64(seed);
+        Next32();
+    }
+
+    uint32_t Next32()
+    {
+        uint64_t old = State;
+        State = old * 6364136223846793005ULL + Inc;
+        uint32_t xorshifted = ((old >> 18) ^ old) >> 27;
+        uint32_t rot = old >> 59;
+        return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+    }
+
+    uint64_t Next()
+    {
+        uint64_t high = Next32();
+        return (high << 32) | Next32();
+    }
+
+    // Switch to the next stream, which never overlaps the current one
+    void Jump()
+    {
+        Inc += 2;
+    }
+
+    static constexpr uint64_t min() { return 0; }
+    static constexpr uint64_t max() { return ~0ULL; }
+    uint64_t operator()() { return Next(); }
+
+private:
+
+    uint64_t State, Inc;
+};
+
+//-----------------------------------------------------------------------------
+
+#ifdef RANDOM_PCG
+typedef PCG32 RANDOM_GENERATOR;
+#else
+typedef XOSHIRO256 RANDOM_GENERATOR;
+#endif
+
+#endif // RANDOM_H
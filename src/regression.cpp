@@ -0,0 +1,284 @@
+#include "regression.h"
+#include "experiment.h"
+#include "rocksample.h"
+#include <sys/resource.h>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+using namespace std;
+using namespace UTILS;
+
+REGRESSION::PARAMS::PARAMS()
+:   Threshold(0.2),
+    Doubles(12),
+    NumRuns(8),
+    Repeats(5),
+    Seed(1),
+    WriteBaseline(false)
+{
+}
+
+REGRESSION::REGRESSION(const MCTS::PARAMS& searchParams, const PARAMS& params)
+:   SearchParams(searchParams),
+    Params(params)
+{
+    SearchParams.Verbose = 0;
+}
+
+bool REGRESSION::Run(ostream& ostr)
+{
+    static const int layouts[][2] = { { 5, 5 }, { 7, 8 }, { 11, 11 } };
+    vector<MEASUREMENT> measurements;
+    streamsize precision = ostr.precision();
+    ostr << left << setw(20) << "Layout" << right << setw(16) << "Simulations/s"
+        << setw(14) << "Decisions/s" << setw(10) << "Noise %" << setw(14) << "Peak RSS kB"
+        << setw(12) << "Nodes" << endl;
+    for (int i = 0; i < 3; i++)
+    {
+        MEASUREMENT measured = Measure(layouts[i][0], layouts[i][1]);
+        ostr << left << setw(20) << measured.Name << right << fixed << setprecision(0)
+            << setw(16) << measured.SimulationsPerSecond
+            << setw(14) << measured.DecisionsPerSecond
+            << setw(10) << setprecision(1) << measured.Noise * 100 << setprecision(0)
+            << setw(14) << measured.PeakRSS
+            << setw(12) << measured.Nodes << endl;
+        ostr.unsetf(ios::floatfield);
+        ostr.precision(precision);
+        measurements.push_back(measured);
+    }
+
+    if (Params.WriteBaseline)
+    {
+        ofstream baselineFile(Params.BaselineFile.c_str());
+        Write(measurements, baselineFile);
+        ostr << "Wrote baseline " << Params.BaselineFile << endl;
+        return true;
+    }
+
+    ifstream baselineFile(Params.BaselineFile.c_str());
+    vector<MEASUREMENT> baselines;
+    if (!Read(baselineFile, baselines))
+    {
+        ostr << "Cannot read baseline " << Params.BaselineFile << endl;
+        return false;
+    }
+
+    int numRegressions = 0;
+    for (int i = 0; i < (int) measurements.size(); i++)
+    {
+        vector<string> regressions;
+        int j = 0;
+        while (j < (int) baselines.size() && baselines[j].Name != measurements[i].Name)
+            j++;
+        if (j == (int) baselines.size())
+            regressions.push_back("no baseline");
+        else
+            Compare(baselines[j], measurements[i], Params.Threshold, regressions);
+        for (int r = 0; r < (int) regressions.size(); r++)
+            ostr << "Regression in " << measurements[i].Name << ": " << regressions[r] << endl;
+        numRegressions += regressions.size();
+    }
+    if (numRegressions == 0)
+        ostr << "No regressions beyond " << Params.Threshold * 100
+            << "% of the baseline, plus noise for throughput" << endl;
+    return numRegressions == 0;
+}
+
+REGRESSION::MEASUREMENT REGRESSION::Measure(int size, int rocks)
+{
+    ROCKSAMPLE real(size, rocks);
+    ROCKSAMPLE simulator(size, rocks);
+    EXPERIMENT::PARAMS expParams;
+    expParams.Seed = Params.Seed;
+
+    MEASUREMENT measured;
+    vector<double> times;
+    for (int repeat = 0; repeat < Params.Repeats; repeat++)
+    {
+        MCTS::PARAMS searchParams = SearchParams;
+        EXPERIMENT experiment(real, simulator, "", expParams, searchParams);
+        experiment.SetSimulations(Params.Doubles);
+
+        RESULTS results;
+        ostringstream log;
+        for (int n = 0; n < Params.NumRuns; n++)
+        {
+            RandomSeed(Params.Seed, n);
+            experiment.Run(results, log, n);
+        }
+
+        // Every repeat plays the same episodes, so only the time may differ
+        if (repeat == 0)
+        {
+            measured.Nodes = results.Nodes.GetTotal();
+            measured.SimulationsPerSecond = results.Simulations.GetTotal();
+            measured.DecisionsPerSecond = results.Simulations.GetCount();
+        }
+        else if (results.Nodes.GetTotal() != measured.Nodes)
+            measured.Reproducible = false;
+        times.push_back(results.Time.GetTotal());
+    }
+
+    sort(times.begin(), times.end());
+    double median = times[times.size() / 2];
+    measured.SimulationsPerSecond /= median;
+    measured.DecisionsPerSecond /= median;
+    measured.Noise = (times.back() - times.front()) / (2 * median);
+
+    // The high-water mark can only grow, so layouts are measured from the
+    // smallest up
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    ostringstream name;
+    name << "rocksample_" << size << "_" << rocks;
+    measured.Name = name.str();
+    measured.Doubles = Params.Doubles;
+    measured.NumRuns = Params.NumRuns;
+    measured.PeakRSS = usage.ru_maxrss;
+    return measured;
+}
+
+void REGRESSION::Write(const vector<MEASUREMENT>& measurements, ostream& ostr)
+{
+    ostr << "# name doubles runs simulations/s decisions/s peak_rss_kB nodes" << endl;
+    for (int i = 0; i < (int) measurements.size(); i++)
+    {
+        const MEASUREMENT& m = measurements[i];
+        ostr << m.Name << " " << m.Doubles << " " << m.NumRuns << " " << fixed
+            << setprecision(1) << m.SimulationsPerSecond << " " << m.DecisionsPerSecond
+            << " " << m.PeakRSS << " " << setprecision(0) << m.Nodes << endl;
+        ostr.unsetf(ios::floatfield);
+    }
+}
+
+bool REGRESSION::Read(istream& istr, vector<MEASUREMENT>& measurements)
+{
+    if (!istr)
+        return false;
+    string line;
+    while (getline(istr, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        istringstream fields(line);
+        MEASUREMENT m;
+        if (!(fields >> m.Name >> m.Doubles >> m.NumRuns >> m.SimulationsPerSecond
+            >> m.DecisionsPerSecond >> m.PeakRSS >> m.Nodes))
+            return false;
+        measurements.push_back(m);
+    }
+    return true;
+}
+
+void REGRESSION::Compare(const MEASUREMENT& baseline, const MEASUREMENT& measured,
+    double threshold, vector<string>& regressions)
+{
+    if (baseline.Doubles != measured.Doubles || baseline.NumRuns != measured.NumRuns)
+    {
+        regressions.push_back("budget differs from the baseline");
+        return;
+    }
+
+    // Throughput may fall by the threshold plus the noise of the repeats,
+    // and memory grow by the threshold
+    double margin = threshold + measured.Noise;
+    struct { const char* Name; double Baseline, Measured, Allowed; bool Higher; } measures[] =
+    {
+        { "simulations/s", baseline.SimulationsPerSecond, measured.SimulationsPerSecond, margin, true },
+        { "decisions/s", baseline.DecisionsPerSecond, measured.DecisionsPerSecond, margin, true },
+        { "peak RSS kB", (double) baseline.PeakRSS, (double) measured.PeakRSS, threshold, false }
+    };
+    for (int i = 0; i < 3; i++)
+    {
+        double change = (measures[i].Measured - measures[i].Baseline) / measures[i].Baseline;
+        if (measures[i].Higher ? change < -measures[i].Allowed : change > measures[i].Allowed)
+        {
+            ostringstream regression;
+            regression << measures[i].Name << " " << measures[i].Measured
+                << " against " << measures[i].Baseline << " ("
+                << showpos << fixed << setprecision(1) << change * 100 << "%)";
+            regressions.push_back(regression.str());
+        }
+    }
+
+    // The search is deterministic for the seed, so any change in the nodes
+    // it expands is a change in its behaviour
+    if (!measured.Reproducible)
+        regressions.push_back("nodes differ between repeats");
+    if (measured.Nodes != baseline.Nodes)
+    {
+        ostringstream regression;
+        regression << "nodes " << fixed << setprecision(0) << measured.Nodes
+            << " against " << baseline.Nodes << " (must match)";
+        regressions.push_back(regression.str());
+    }
+}
+
+//----------------------------------------------------------------------------
+
+void REGRESSION::UnitTest()
+{
+    MEASUREMENT baseline;
+    baseline.Name = "rocksample_5_5";
+    baseline.Doubles = 12;
+    baseline.NumRuns = 4;
+    baseline.SimulationsPerSecond = 100000;
+    baseline.DecisionsPerSecond = 25;
+    baseline.PeakRSS = 50000;
+    baseline.Nodes = 80000;
+
+    vector<MEASUREMENT> written(2, baseline), read;
+    written[1].Name = "rocksample_7_8";
+    written[1].SimulationsPerSecond = 12345.6;
+    ostringstream ostr;
+    Write(written, ostr);
+    istringstream istr(ostr.str());
+    assert(Read(istr, read));
+    assert(read.size() == 2 && read[1].Name == "rocksample_7_8");
+    assert(read[1].SimulationsPerSecond == 12345.6 && read[1].Nodes == 80000);
+    istringstream bad("rocksample_5_5 12 4 fast\n");
+    assert(!Read(bad, read));
+
+    // Within the threshold, or better, is no regression
+    vector<string> regressions;
+    MEASUREMENT measured = baseline;
+    measured.SimulationsPerSecond = 85000;
+    measured.DecisionsPerSecond = 40;
+    measured.PeakRSS = 40000;
+    Compare(baseline, measured, 0.2, regressions);
+    assert(regressions.empty());
+
+    measured.SimulationsPerSecond = 75000;
+    measured.Nodes = 80001;
+    Compare(baseline, measured, 0.2, regressions);
+    assert(regressions.size() == 2);
+    assert(regressions[0].compare(0, 14, "simulations/s ") == 0);
+    assert(regressions[0].find("(-25.0%)") != string::npos);
+    assert(regressions[1] == "nodes 80001 against 80000 (must match)");
+
+    // Noisy repeats widen the margin for throughput only
+    regressions.clear();
+    measured.Nodes = baseline.Nodes;
+    measured.Noise = 0.1;
+    measured.PeakRSS = 65000;
+    Compare(baseline, measured, 0.2, regressions);
+    assert(regressions.size() == 1);
+    assert(regressions[0].compare(0, 12, "peak RSS kB ") == 0);
+
+    regressions.clear();
+    measured = baseline;
+    measured.Reproducible = false;
+    Compare(baseline, measured, 0.2, regressions);
+    assert(regressions.size() == 1 && regressions[0] == "nodes differ between repeats");
+
+    regressions.clear();
+    measured = baseline;
+    measured.Doubles = 10;
+    Compare(baseline, measured, 0.2, regressions);
+    assert(regressions.size() == 1);
+}
+
+//----------------------------------------------------------------------------
@@ -0,0 +1,87 @@
+#ifndef REGRESSION_H
+#define REGRESSION_H
+
+#include "mcts.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+//----------------------------------------------------------------------------
+// End-to-end performance regression check. Plays fixed-seed episodes of
+// rocksample (5,5), (7,8) and (11,11) at a fixed simulation budget, measures
+// wall-clock simulations and decisions per second, peak resident memory and
+// tree nodes expanded, and compares them with a baseline file.
+//
+// Each layout is played Repeats times. Throughput is taken from the median
+// repeat, and may fall below the baseline by the threshold plus the noise
+// seen between the repeats, half their range relative to the median. Peak
+// memory may grow by the threshold. The nodes expanded are deterministic for
+// the seed with single-threaded search, so they must match the baseline
+// exactly, and agree between repeats.
+//
+// Throughput depends on the host, so the checked-in baseline only holds for
+// the machine it was written on. Regenerate it with --writebaseline when
+// running the check anywhere else, before the change under test.
+//
+// The baseline file has one line per layout, "#" lines being comments:
+//   <name> <doubles> <runs> <simulations/s> <decisions/s> <peak RSS kB> <nodes>
+
+class REGRESSION
+{
+public:
+
+    struct PARAMS
+    {
+        PARAMS();
+
+        std::string BaselineFile;
+        double Threshold;       // fraction by which a measure may be worse
+        int Doubles;            // 2^Doubles simulations per decision
+        int NumRuns;            // episodes per layout
+        int Repeats;            // measurements of each layout
+        uint64_t Seed;
+        bool WriteBaseline;     // measure and write the baseline file
+    };
+
+    struct MEASUREMENT
+    {
+        MEASUREMENT() : Noise(0), Reproducible(true) { }
+
+        std::string Name;
+        int Doubles, NumRuns;
+        double SimulationsPerSecond;
+        double DecisionsPerSecond;
+        long PeakRSS;           // kB, of the whole process so far
+        double Nodes;           // expanded over all runs
+        // Half the range of the repeated throughputs relative to their
+        // median, and whether every repeat expanded the same nodes. Not
+        // stored in the baseline file.
+        double Noise;
+        bool Reproducible;
+    };
+
+    REGRESSION(const MCTS::PARAMS& searchParams, const PARAMS& params);
+
+    // Returns false if any layout regressed or has no baseline
+    bool Run(std::ostream& ostr);
+
+    static void Write(const std::vector<MEASUREMENT>& measurements, std::ostream& ostr);
+    static bool Read(std::istream& istr, std::vector<MEASUREMENT>& measurements);
+
+    // Describe each measure worse than the baseline by more than allowed
+    static void Compare(const MEASUREMENT& baseline, const MEASUREMENT& measured,
+        double threshold, std::vector<std::string>& regressions);
+
+    static void UnitTest();
+
+private:
+
+    MEASUREMENT Measure(int size, int rocks);
+
+    MCTS::PARAMS SearchParams;
+    PARAMS Params;
+};
+
+//----------------------------------------------------------------------------
+
+#endif // REGRESSION_H
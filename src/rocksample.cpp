@@ -1,5 +1,6 @@
 #include "rocksample.h"
 #include "utils.h"
+#include "statistic.h"
 
 using namespace std;
 using namespace UTILS;
@@ -11,6 +12,7 @@ ROCKSAMPLE::ROCKSAMPLE(int size, int rocks)
     SmartMoveProb(0.95),
     UncertaintyCount(0)
 {
+    assert(NumRocks <= ROCKSAMPLE_STATE::MaxRocks);
     NumActions = NumRocks + 5;
     NumObservations = 3;
     RewardRange = 20;
@@ -26,6 +28,41 @@ ROCKSAMPLE::ROCKSAMPLE(int size, int rocks)
         Init_11_11();
     else
         InitGeneral();
+
+    // The sensor efficiency depends only on the agent's cell and the rock,
+    // so it is tabulated once rather than recomputed on every check
+    Efficiency.resize(Size * Size * NumRocks);
+    for (int y = 0; y < Size; ++y)
+    {
+        for (int x = 0; x < Size; ++x)
+        {
+            for (int rock = 0; rock < NumRocks; ++rock)
+            {
+                double distance = COORD::EuclideanDistance(COORD(x, y), RockPos[rock]);
+                Efficiency[Grid.Index(x, y) * NumRocks + rock] =
+                    (1 + pow(2, -distance / HalfEfficiencyDistance)) * 0.5;
+            }
+        }
+    }
+
+    NorthOf.assign(Size, 0);
+    SouthOf.assign(Size, 0);
+    WestOf.assign(Size, 0);
+    EastOf.assign(Size, 0);
+    for (int i = 0; i < Size; ++i)
+    {
+        for (int rock = 0; rock < NumRocks; ++rock)
+        {
+            if (RockPos[rock].Y > i)
+                NorthOf[i] |= 1 << rock;
+            if (RockPos[rock].Y < i)
+                SouthOf[i] |= 1 << rock;
+            if (RockPos[rock].X < i)
+                WestOf[i] |= 1 << rock;
+            if (RockPos[rock].X > i)
+                EastOf[i] |= 1 << rock;
+        }
+    }
 }
 
 void ROCKSAMPLE::InitGeneral()
@@ -171,19 +208,9 @@ STATE* ROCKSAMPLE::CreateStartState() const
 {
     ROCKSAMPLE_STATE* rockstate = MemoryPool.Allocate();
     rockstate->AgentPos = StartPos;
-    rockstate->Rocks.clear();
+    rockstate->ClearRocks();
     for (int i = 0; i < NumRocks; i++)
-    {
-        ROCKSAMPLE_STATE::ENTRY entry;
-        entry.Collected = false;
-        entry.Valuable = Bernoulli(0.5);
-        entry.Count = 0;
-        entry.Measured = 0;
-        entry.ProbValuable = 0.5;
-        entry.LikelihoodValuable = 1.0;
-        entry.LikelihoodWorthless = 1.0;
-        rockstate->Rocks.push_back(entry);
-    }
+        rockstate->SetValuable(i, Bernoulli(0.5));
     rockstate->Target = SelectTarget(*rockstate);
     return rockstate;
 }
@@ -244,10 +271,10 @@ bool ROCKSAMPLE::Step(STATE& state, int action,
     if (action == E_SAMPLE) // sample
     {
         int rock = Grid(rockstate.AgentPos);
-        if (rock >= 0 && !rockstate.Rocks[rock].Collected)
+        if (rock >= 0 && !rockstate.Collected(rock))
         {
-            rockstate.Rocks[rock].Collected = true;
-            if (rockstate.Rocks[rock].Valuable)
+            rockstate.SetCollected(rock, true);
+            if (rockstate.Valuable(rock))
                 rewardcost.R = +10;
             else
                 rewardcost.R = -10;
@@ -264,27 +291,23 @@ bool ROCKSAMPLE::Step(STATE& state, int action,
         int rock = action - E_SAMPLE - 1;
         assert(rock < NumRocks);
         observation = GetObservation(rockstate, rock);
-        rockstate.Rocks[rock].Measured++;
-
-        double distance = COORD::EuclideanDistance(rockstate.AgentPos, RockPos[rock]);
-    	double efficiency = (1 + pow(2, -distance / HalfEfficiencyDistance)) * 0.5;
+        rockstate.AddMeasured(rock);
 
+        // Only a check at full efficiency can drive the likelihood of the
+        // other answer to zero
+        bool exact = GetEfficiency(rockstate.AgentPos, rock) == 1.0;
         if (observation == E_GOOD)
         {
-            rockstate.Rocks[rock].Count++;
-            rockstate.Rocks[rock].LikelihoodValuable *= efficiency;
-            rockstate.Rocks[rock].LikelihoodWorthless *= 1.0 - efficiency;
-
+            rockstate.Count[rock]++;
+            if (exact)
+                rockstate.RuledOutWorthless |= 1 << rock;
         }
         else
         {
-            rockstate.Rocks[rock].Count--;
-            rockstate.Rocks[rock].LikelihoodWorthless *= efficiency;
-            rockstate.Rocks[rock].LikelihoodValuable *= 1.0 - efficiency;
+            rockstate.Count[rock]--;
+            if (exact)
+                rockstate.RuledOutValuable |= 1 << rock;
 		}
-		double denom = (0.5 * rockstate.Rocks[rock].LikelihoodValuable) +
-			(0.5 * rockstate.Rocks[rock].LikelihoodWorthless);
-		rockstate.Rocks[rock].ProbValuable = (0.5 * rockstate.Rocks[rock].LikelihoodValuable) / denom;
     }
 
     if (rockstate.Target < 0 || rockstate.AgentPos == RockPos[rockstate.Target])
@@ -303,7 +326,7 @@ bool ROCKSAMPLE::LocalMove(STATE& state, const HISTORY& history,
 {
     ROCKSAMPLE_STATE& rockstate = safe_cast<ROCKSAMPLE_STATE&>(state);
     int rock = Random(NumRocks);
-    rockstate.Rocks[rock].Valuable = !rockstate.Rocks[rock].Valuable;
+    rockstate.SetValuable(rock, !rockstate.Valuable(rock));
 
     if (history.Back().Action > E_SAMPLE) // check rock
     {
@@ -315,15 +338,42 @@ bool ROCKSAMPLE::LocalMove(STATE& state, const HISTORY& history,
         if (newObs != realObs)
             return false;
 
-        // Update counts to be consistent with real observation
-        if (realObs == E_GOOD && stepObs == E_BAD)
-            rockstate.Rocks[rock].Count += 2;
-        if (realObs == E_BAD && stepObs == E_GOOD)
-            rockstate.Rocks[rock].Count -= 2;
+        ConditionObservation(rockstate, history.Back().Action, realObs, stepObs);
     }
     return true;
 }
 
+// A check reports the true value of the rock with the efficiency of the
+// agent's position, and every other action observes nothing
+double ROCKSAMPLE::ObservationProbability(const STATE& state, int action,
+    int observation, int stepObs) const
+{
+    const ROCKSAMPLE_STATE& rockstate = safe_cast<const ROCKSAMPLE_STATE&>(state);
+    if (action <= E_SAMPLE)
+        return observation == E_NONE ? 1 : 0;
+    if (observation == E_NONE)
+        return 0;
+
+    int rock = action - E_SAMPLE - 1;
+    double efficiency = GetEfficiency(rockstate.AgentPos, rock);
+    bool good = observation == E_GOOD;
+    return good == rockstate.Valuable(rock) ? efficiency : 1 - efficiency;
+}
+
+// Update counts to be consistent with real observation
+void ROCKSAMPLE::ConditionObservation(STATE& state, int action,
+    int observation, int stepObs) const
+{
+    ROCKSAMPLE_STATE& rockstate = safe_cast<ROCKSAMPLE_STATE&>(state);
+    if (action <= E_SAMPLE)
+        return;
+    int rock = action - E_SAMPLE - 1;
+    if (observation == E_GOOD && stepObs == E_BAD)
+        rockstate.Count[rock] += 2;
+    if (observation == E_BAD && stepObs == E_GOOD)
+        rockstate.Count[rock] -= 2;
+}
+
 void ROCKSAMPLE::GenerateLegal(const STATE& state, const HISTORY& history,
     vector<int>& legal, const STATUS& status) const
 {
@@ -343,11 +393,11 @@ void ROCKSAMPLE::GenerateLegal(const STATE& state, const HISTORY& history,
         legal.push_back(COORD::E_WEST);
 
     int rock = Grid(rockstate.AgentPos);
-    if (rock >= 0 && !rockstate.Rocks[rock].Collected)
+    if (rock >= 0 && !rockstate.Collected(rock))
         legal.push_back(E_SAMPLE);
 
     for (rock = 0; rock < NumRocks; ++rock)
-        if (!rockstate.Rocks[rock].Collected)
+        if (!rockstate.Collected(rock))
             legal.push_back(rock + 1 + E_SAMPLE);
 }
 
@@ -366,22 +416,15 @@ void ROCKSAMPLE::GeneratePreferred(const STATE& state, const HISTORY& history,
 	const ROCKSAMPLE_STATE& rockstate =
 	        safe_cast<const ROCKSAMPLE_STATE&>(state);
 
+	// The state tallies +ve minus -ve observations of each rock as it is
+	// checked, which for any state consistent with the history equals the
+	// tally over the history itself
+
 	// Sample rocks with more +ve than -ve observations
 	int rock = Grid(rockstate.AgentPos);
-	if (rock >= 0 && !rockstate.Rocks[rock].Collected)
+	if (rock >= 0 && !rockstate.Collected(rock))
 	{
-		int total = 0;
-		for (int t = 0; t < history.Size(); ++t)
-		{
-			if (history[t].Action == rock + 1 + E_SAMPLE)
-			{
-				if (history[t].Observation == E_GOOD)
-					total++;
-				if (history[t].Observation == E_BAD)
-					total--;
-			}
-		}
-		if (total > 0)
+		if (rockstate.Count[rock] > 0)
 		{
 			actions.push_back(E_SAMPLE);
 			return;
@@ -398,22 +441,9 @@ void ROCKSAMPLE::GeneratePreferred(const STATE& state, const HISTORY& history,
 
 	for (int rock = 0; rock < NumRocks; ++rock)
 	{
-		const ROCKSAMPLE_STATE::ENTRY& entry = rockstate.Rocks[rock];
-		if (!entry.Collected)
+		if (!rockstate.Collected(rock))
 		{
-			int total = 0;
-			for (int t = 0; t < history.Size(); ++t)
-			{
-				if (history[t].Action == rock + 1 + E_SAMPLE)
-				{
-					if (history[t].Observation == E_GOOD)
-						total++;
-					if (history[t].Observation == E_BAD)
-						total--;
-				}
-			}
-
-			if (total >= 0)
+			if (rockstate.Count[rock] >= 0)
 			{
 				all_bad = false;
 
@@ -458,26 +488,328 @@ void ROCKSAMPLE::GeneratePreferred(const STATE& state, const HISTORY& history,
 
 	for (rock = 0; rock < NumRocks; ++rock)
 	{
-		if (!rockstate.Rocks[rock].Collected    &&
-			rockstate.Rocks[rock].ProbValuable != 0.0 &&
-			rockstate.Rocks[rock].ProbValuable != 1.0 &&
-			rockstate.Rocks[rock].Measured < 5  &&
-			std::abs(rockstate.Rocks[rock].Count) < 2)
+		if (!rockstate.Collected(rock)    &&
+			!rockstate.Certain(rock) &&
+			rockstate.Measured[rock] < 5  &&
+			std::abs(rockstate.Count[rock]) < 2)
 		{
 			actions.push_back(rock + 1 + E_SAMPLE);
 		}
 	}
 }
 
-int ROCKSAMPLE::GetObservation(const ROCKSAMPLE_STATE& rockstate, int rock) const
+//-----------------------------------------------------------------------------
+// Batched rollouts. The smart knowledge of each lane is kept per rock, to be
+// written back to the states, and as bit masks, from which the rollout
+// policy chooses an action without a loop over the rocks. Each step of the
+// batch draws random numbers lane by lane, in the order SelectRandom and
+// Step would, so a batch of one state reproduces a single rollout exactly.
+
+struct ROCKSAMPLE::LANES
+{
+    void Resize(int numLanes)
+    {
+        X.resize(numLanes);
+        Y.resize(numLanes);
+        Valuable.resize(numLanes);
+        Collected.resize(numLanes);
+        RuledOutValuable.resize(numLanes);
+        RuledOutWorthless.resize(numLanes);
+        Positive.resize(numLanes);
+        NonNegative.resize(numLanes);
+        Unsure.resize(numLanes);
+        Fresh.resize(numLanes);
+        Count.resize(numLanes * ROCKSAMPLE_STATE::MaxRocks);
+        Measured.resize(numLanes * ROCKSAMPLE_STATE::MaxRocks);
+        StepR.resize(numLanes);
+        StepC.resize(numLanes);
+        ReturnR.resize(numLanes);
+        ReturnC.resize(numLanes);
+        Steps.resize(numLanes);
+        Active.resize(numLanes);
+    }
+
+    // Bring the masks of a rock up to date with its count and checks
+    void UpdateMasks(int lane, int rock)
+    {
+        int count = Count[lane * ROCKSAMPLE_STATE::MaxRocks + rock];
+        int measured = Measured[lane * ROCKSAMPLE_STATE::MaxRocks + rock];
+        SetMask(Positive[lane], rock, count > 0);
+        SetMask(NonNegative[lane], rock, count >= 0);
+        SetMask(Unsure[lane], rock, count > -2 && count < 2);
+        SetMask(Fresh[lane], rock, measured < 5);
+    }
+
+    static void SetMask(uint16_t& mask, int rock, bool value)
+    {
+        mask = value ? mask | (1 << rock) : mask & ~(1 << rock);
+    }
+
+    std::vector<int> X, Y;
+    std::vector<uint16_t> Valuable, Collected;
+    std::vector<uint16_t> RuledOutValuable, RuledOutWorthless;
+    // Rocks whose count is positive, non-negative or within one of zero,
+    // and rocks checked fewer than five times
+    std::vector<uint16_t> Positive, NonNegative, Unsure, Fresh;
+    std::vector<int16_t> Count;
+    std::vector<uint8_t> Measured;
+    // Reward and cost of the current step, zero for lanes not stepped
+    std::vector<double> StepR, StepC;
+    std::vector<double> ReturnR, ReturnC;
+    std::vector<int> Steps;
+    // Lanes that have not terminated
+    std::vector<int> Active;
+};
+
+void ROCKSAMPLE::RolloutBatch(STATE** states, int numStates,
+    HISTORY& history, const STATUS& status, int maxSteps,
+    RC* returns, int* numSteps) const
 {
-    double distance = COORD::EuclideanDistance(rockstate.AgentPos, RockPos[rock]);
-    double efficiency = (1 + pow(2, -distance / HalfEfficiencyDistance)) * 0.5;
+    static thread_local LANES lanes;
+    lanes.Resize(numStates);
+
+    for (int i = 0; i < numStates; ++i)
+    {
+        const ROCKSAMPLE_STATE& rockstate =
+            safe_cast<const ROCKSAMPLE_STATE&>(*states[i]);
+        lanes.X[i] = rockstate.AgentPos.X;
+        lanes.Y[i] = rockstate.AgentPos.Y;
+        lanes.Valuable[i] = lanes.Collected[i] = 0;
+        for (int rock = 0; rock < NumRocks; ++rock)
+        {
+            LANES::SetMask(lanes.Valuable[i], rock, rockstate.Valuable(rock));
+            LANES::SetMask(lanes.Collected[i], rock, rockstate.Collected(rock));
+            lanes.Count[i * ROCKSAMPLE_STATE::MaxRocks + rock] = rockstate.Count[rock];
+            lanes.Measured[i * ROCKSAMPLE_STATE::MaxRocks + rock] = rockstate.Measured[rock];
+            lanes.UpdateMasks(i, rock);
+        }
+        lanes.RuledOutValuable[i] = rockstate.RuledOutValuable;
+        lanes.RuledOutWorthless[i] = rockstate.RuledOutWorthless;
+        lanes.StepR[i] = lanes.StepC[i] = 0;
+        lanes.ReturnR[i] = lanes.ReturnC[i] = 0;
+        lanes.Steps[i] = 0;
+        lanes.Active[i] = i;
+    }
+
+    int numActive = numStates;
+    double discount = 1.0;
+    for (int step = 0; step < maxSteps && numActive > 0; ++step)
+    {
+        int stillActive = 0;
+        for (int j = 0; j < numActive; ++j)
+        {
+            int i = lanes.Active[j];
+            bool terminal = StepRollout(lanes, i, SelectRollout(lanes, i));
+            lanes.Steps[i]++;
+            if (!terminal)
+                lanes.Active[stillActive++] = i;
+        }
+        numActive = stillActive;
+
+        // Terminated lanes add nothing, so the whole batch is accumulated
+        // without branches
+        double* returnR = &lanes.ReturnR[0];
+        double* returnC = &lanes.ReturnC[0];
+        double* stepR = &lanes.StepR[0];
+        double* stepC = &lanes.StepC[0];
+        for (int i = 0; i < numStates; ++i)
+        {
+            returnR[i] += stepR[i] * discount;
+            returnC[i] += stepC[i] * discount;
+            stepR[i] = 0;
+            stepC[i] = 0;
+        }
+        discount *= Discount;
+    }
+
+    for (int i = 0; i < numStates; ++i)
+    {
+        ROCKSAMPLE_STATE& rockstate = safe_cast<ROCKSAMPLE_STATE&>(*states[i]);
+        rockstate.AgentPos = COORD(lanes.X[i], lanes.Y[i]);
+        for (int rock = 0; rock < NumRocks; ++rock)
+        {
+            rockstate.SetCollected(rock, (lanes.Collected[i] >> rock) & 1);
+            rockstate.Count[rock] = lanes.Count[i * ROCKSAMPLE_STATE::MaxRocks + rock];
+            rockstate.Measured[rock] = lanes.Measured[i * ROCKSAMPLE_STATE::MaxRocks + rock];
+        }
+        rockstate.RuledOutValuable = lanes.RuledOutValuable[i];
+        rockstate.RuledOutWorthless = lanes.RuledOutWorthless[i];
+
+        // The target plays no part in rollouts, so it is only reselected
+        // for the final position
+        if (lanes.Steps[i] > 0 && (rockstate.Target < 0
+            || rockstate.AgentPos == RockPos[rockstate.Target]))
+            rockstate.Target = SelectTarget(rockstate);
+
+        returns[i] = RC(lanes.ReturnR[i], lanes.ReturnC[i]);
+        numSteps[i] = lanes.Steps[i];
+    }
+}
+
+// The choice SelectRandom would make, from the same lists of preferred and
+// legal actions as GeneratePreferred and GenerateLegal
+int ROCKSAMPLE::SelectRollout(const LANES& lanes, int lane) const
+{
+    if (Knowledge.RolloutLevel < KNOWLEDGE::LEGAL)
+        return Random(NumActions);
+
+    int x = lanes.X[lane], y = lanes.Y[lane];
+    int rock = Grid(x, y);
+    uint16_t uncollected = ((1 << NumRocks) - 1) & ~lanes.Collected[lane];
+
+    // Each list is some moves followed by the checks of a set of rocks
+    int moves[5];
+    int numMoves = 0;
+    uint16_t checks = 0;
+
+    if (Knowledge.RolloutLevel >= KNOWLEDGE::SMART)
+    {
+        uint16_t interesting = uncollected & lanes.NonNegative[lane];
+        if (rock >= 0 && ((uncollected & lanes.Positive[lane]) >> rock) & 1)
+            moves[numMoves++] = E_SAMPLE;
+        else if (!interesting)
+            moves[numMoves++] = COORD::E_EAST;
+        else
+        {
+            if (y + 1 < Size && (interesting & NorthOf[y]))
+                moves[numMoves++] = COORD::E_NORTH;
+            if (interesting & EastOf[x])
+                moves[numMoves++] = COORD::E_EAST;
+            if (y - 1 >= 0 && (interesting & SouthOf[y]))
+                moves[numMoves++] = COORD::E_SOUTH;
+            if (x - 1 >= 0 && (interesting & WestOf[x]))
+                moves[numMoves++] = COORD::E_WEST;
+            uint16_t certain = lanes.RuledOutValuable[lane] ^ lanes.RuledOutWorthless[lane];
+            checks = uncollected & ~certain
+                & lanes.Fresh[lane] & lanes.Unsure[lane];
+        }
+    }
+
+    if (numMoves == 0 && checks == 0)
+    {
+        if (y + 1 < Size)
+            moves[numMoves++] = COORD::E_NORTH;
+        moves[numMoves++] = COORD::E_EAST;
+        if (y - 1 >= 0)
+            moves[numMoves++] = COORD::E_SOUTH;
+        if (x - 1 >= 0)
+            moves[numMoves++] = COORD::E_WEST;
+        if (rock >= 0 && (uncollected >> rock) & 1)
+            moves[numMoves++] = E_SAMPLE;
+        checks = uncollected;
+    }
+
+    int n = Random(numMoves + __builtin_popcount(checks));
+    if (n < numMoves)
+        return moves[n];
+    for (n -= numMoves; n > 0; --n)
+        checks &= checks - 1;
+    return __builtin_ctz(checks) + 1 + E_SAMPLE;
+}
+
+// Step on a lane, leaving its reward and cost in StepR and StepC
+bool ROCKSAMPLE::StepRollout(LANES& lanes, int lane, int action) const
+{
+    int& x = lanes.X[lane];
+    int& y = lanes.Y[lane];
+    double reward = 0, cost = 0;
+
+    if (action < E_SAMPLE) // move
+    {
+        switch (action)
+        {
+            case COORD::E_EAST:
+                if (x + 1 < Size)
+                {
+                    x++;
+                    break;
+                }
+                else
+                {
+                    lanes.StepR[lane] = +10;
+                    lanes.StepC[lane] = 0;
+                    return true;
+                }
+
+            case COORD::E_NORTH:
+                if (y + 1 < Size)
+                    y++;
+                else
+                    reward = -100;
+                break;
+
+            case COORD::E_SOUTH:
+                if (y - 1 >= 0)
+                    y--;
+                else
+                    reward = -100;
+                break;
+
+            case COORD::E_WEST:
+                if (x - 1 >= 0)
+                    x--;
+                else
+                    reward = -100;
+                break;
+        }
+    }
+
+    if (action == E_SAMPLE) // sample
+    {
+        int rock = Grid(x, y);
+        if (rock >= 0 && !((lanes.Collected[lane] >> rock) & 1))
+        {
+            LANES::SetMask(lanes.Collected[lane], rock, true);
+            reward = (lanes.Valuable[lane] >> rock) & 1 ? +10 : -10;
+        }
+        else
+        {
+            reward = -100;
+        }
+    }
 
-    if (Bernoulli(efficiency))
-        return rockstate.Rocks[rock].Valuable ? E_GOOD : E_BAD;
+    if (action > E_SAMPLE) // check
+    {
+        cost = 1;
+        int rock = action - E_SAMPLE - 1;
+        assert(rock < NumRocks);
+        double efficiency = GetEfficiency(COORD(x, y), rock);
+        bool valuable = (lanes.Valuable[lane] >> rock) & 1;
+        bool good = Bernoulli(efficiency) ? valuable : !valuable;
+
+        int index = lane * ROCKSAMPLE_STATE::MaxRocks + rock;
+        if (lanes.Measured[index] < 255)
+            lanes.Measured[index]++;
+        if (good)
+        {
+            lanes.Count[index]++;
+            if (efficiency == 1.0)
+                LANES::SetMask(lanes.RuledOutWorthless[lane], rock, true);
+        }
+        else
+        {
+            lanes.Count[index]--;
+            if (efficiency == 1.0)
+                LANES::SetMask(lanes.RuledOutValuable[lane], rock, true);
+        }
+        lanes.UpdateMasks(lane, rock);
+    }
+
+    if (reward < 0)
+        cost = 1;
+
+    assert(reward != -100);
+    lanes.StepR[lane] = reward;
+    lanes.StepC[lane] = cost;
+    return false;
+}
+
+int ROCKSAMPLE::GetObservation(const ROCKSAMPLE_STATE& rockstate, int rock) const
+{
+    if (Bernoulli(GetEfficiency(rockstate.AgentPos, rock)))
+        return rockstate.Valuable(rock) ? E_GOOD : E_BAD;
     else
-        return rockstate.Rocks[rock].Valuable ? E_BAD : E_GOOD;
+        return rockstate.Valuable(rock) ? E_BAD : E_GOOD;
 }
 
 int ROCKSAMPLE::SelectTarget(const ROCKSAMPLE_STATE& rockstate) const
@@ -486,8 +818,8 @@ int ROCKSAMPLE::SelectTarget(const ROCKSAMPLE_STATE& rockstate) const
     int bestRock = -1;
     for (int rock = 0; rock < NumRocks; ++rock)
     {
-        if (!rockstate.Rocks[rock].Collected
-            && rockstate.Rocks[rock].Count >= UncertaintyCount)
+        if (!rockstate.Collected(rock)
+            && rockstate.Count[rock] >= UncertaintyCount)
         {
             int dist = COORD::ManhattanDistance(rockstate.AgentPos, RockPos[rock]);
             if (dist < bestDist)
@@ -516,11 +848,10 @@ void ROCKSAMPLE::DisplayState(const STATE& state, std::ostream& ostr) const
         {
             COORD pos(x, y);
             int rock = Grid(pos);
-            const ROCKSAMPLE_STATE::ENTRY& entry = rockstate.Rocks[rock];
             if (rockstate.AgentPos == COORD(x, y))
                 ostr << "* ";
-            else if (rock >= 0 && !entry.Collected)
-                ostr << rock << (entry.Valuable ? "$" : "X");
+            else if (rock >= 0 && !rockstate.Collected(rock))
+                ostr << rock << (rockstate.Valuable(rock) ? "$" : "X");
             else
                 ostr << ". ";
         }
@@ -555,3 +886,171 @@ void ROCKSAMPLE::DisplayAction(int action, std::ostream& ostr) const
     if (action > E_SAMPLE)
         ostr << "Check " << action - E_SAMPLE << endl;
 }
+
+//-----------------------------------------------------------------------------
+
+static bool SameState(const ROCKSAMPLE_STATE& a, const ROCKSAMPLE_STATE& b)
+{
+    if (!(a.AgentPos == b.AgentPos) || a.Target != b.Target
+        || a.RuledOutValuable != b.RuledOutValuable
+        || a.RuledOutWorthless != b.RuledOutWorthless)
+        return false;
+    for (int rock = 0; rock < ROCKSAMPLE_STATE::MaxRocks; ++rock)
+    {
+        if (a.Valuable(rock) != b.Valuable(rock)
+            || a.Collected(rock) != b.Collected(rock)
+            || a.Count[rock] != b.Count[rock]
+            || a.Measured[rock] != b.Measured[rock])
+            return false;
+    }
+    return true;
+}
+
+void ROCKSAMPLE::UnitTest()
+{
+    ROCKSAMPLE rocksample(7, 16);
+    STATUS status;
+    status.Phase = STATUS::ROLLOUT;
+    HISTORY history;
+
+    // Pure rollouts may choose illegal actions, which Step rejects
+    for (int level = KNOWLEDGE::LEGAL; level < KNOWLEDGE::NUM_LEVELS; ++level)
+    {
+        KNOWLEDGE knowledge;
+        knowledge.RolloutLevel = level;
+        rocksample.SetKnowledge(knowledge);
+
+        // A batch of one is an ordinary rollout, from any state
+        for (int n = 0; n < 200; ++n)
+        {
+            RandomSeed(n);
+            STATE* start = rocksample.CreateStartState();
+            ROCKSAMPLE_STATE& rockstate = safe_cast<ROCKSAMPLE_STATE&>(*start);
+            rockstate.AgentPos = COORD(Random(7), Random(7));
+            for (int rock = 0; rock < 16; ++rock)
+            {
+                rockstate.SetCollected(rock, Bernoulli(0.2));
+                for (int i = Random(4); i > 0; --i)
+                {
+                    int observation;
+                    RC rewardcost;
+                    rocksample.Step(*start, rock + 1 + E_SAMPLE, observation, rewardcost);
+                }
+            }
+
+            STATE* single = rocksample.Copy(*start);
+            STATE* batch = rocksample.Copy(*start);
+            RC singleReturn, batchReturn;
+            int singleSteps, batchSteps;
+            RandomSeed(n + 1000);
+            rocksample.SIMULATOR::RolloutBatch(&single, 1, history, status,
+                n % 60, &singleReturn, &singleSteps);
+            RandomSeed(n + 1000);
+            rocksample.RolloutBatch(&batch, 1, history, status,
+                n % 60, &batchReturn, &batchSteps);
+            assert(singleReturn.R == batchReturn.R);
+            assert(singleReturn.C == batchReturn.C);
+            assert(singleSteps == batchSteps);
+            assert(SameState(safe_cast<ROCKSAMPLE_STATE&>(*single),
+                safe_cast<ROCKSAMPLE_STATE&>(*batch)));
+            rocksample.FreeState(start);
+            rocksample.FreeState(single);
+            rocksample.FreeState(batch);
+        }
+
+        // Larger batches draw in a different order but agree on average
+        const int batchSize = 32, numRollouts = 4096;
+        std::vector<STATE*> states(batchSize);
+        std::vector<RC> returns(batchSize);
+        std::vector<int> numSteps(batchSize);
+        STATISTIC singleStat, batchStat;
+        for (int n = 0; n < numRollouts; n += batchSize)
+        {
+            for (int i = 0; i < batchSize; ++i)
+                states[i] = rocksample.CreateStartState();
+            rocksample.SIMULATOR::RolloutBatch(&states[0], batchSize, history,
+                status, 50, &returns[0], &numSteps[0]);
+            for (int i = 0; i < batchSize; ++i)
+            {
+                singleStat.Add(returns[i].R);
+                rocksample.FreeState(states[i]);
+                states[i] = rocksample.CreateStartState();
+            }
+            rocksample.RolloutBatch(&states[0], batchSize, history,
+                status, 50, &returns[0], &numSteps[0]);
+            for (int i = 0; i < batchSize; ++i)
+            {
+                batchStat.Add(returns[i].R);
+                rocksample.FreeState(states[i]);
+            }
+        }
+        double error = sqrt(singleStat.GetStdErr() * singleStat.GetStdErr()
+            + batchStat.GetStdErr() * batchStat.GetStdErr());
+        assert(fabs(singleStat.GetMean() - batchStat.GetMean()) < 4 * error);
+    }
+
+    // The observation model agrees with the observations Step makes
+    RandomSeed(0);
+    for (int rock = 0; rock < 16; rock += 5)
+    {
+        int numGood = 0;
+        double probGood = 0;
+        const int numChecks = 4000;
+        for (int n = 0; n < numChecks; ++n)
+        {
+            STATE* state = rocksample.CreateStartState();
+            ROCKSAMPLE_STATE& rockstate = safe_cast<ROCKSAMPLE_STATE&>(*state);
+            rockstate.AgentPos = COORD(rock % 7, 6 - rock % 5);
+            int observation;
+            RC rewardcost;
+            rocksample.Step(*state, rock + 1 + E_SAMPLE, observation, rewardcost);
+            numGood += observation == E_GOOD;
+            probGood += rocksample.ObservationProbability(*state, rock + 1 + E_SAMPLE,
+                E_GOOD, observation);
+            assert(fabs(rocksample.ObservationProbability(*state, rock + 1 + E_SAMPLE,
+                E_GOOD, observation) + rocksample.ObservationProbability(*state,
+                rock + 1 + E_SAMPLE, E_BAD, observation) - 1) < 1e-12);
+
+            // Counts are those of a check that gave the real observation
+            int count = rockstate.Count[rock];
+            int realObs = observation == E_GOOD ? E_BAD : E_GOOD;
+            rocksample.ConditionObservation(*state, rock + 1 + E_SAMPLE, realObs, observation);
+            assert(rockstate.Count[rock] == (realObs == E_GOOD ? count + 2 : count - 2));
+            rocksample.FreeState(state);
+        }
+        assert(fabs(numGood - probGood) < 4 * sqrt(numChecks * 0.25));
+    }
+
+    // LocalMove accepts a moved state as often as the observation model
+    // gives the real observation, so the particles it revives are already
+    // conditioned on it and keep their weights
+    for (int rock = 0; rock < 16; rock += 5)
+    {
+        int numAccepted = 0;
+        double likelihood = 0;
+        const int numMoves = 4000;
+        for (int n = 0; n < numMoves; ++n)
+        {
+            STATE* state = rocksample.CreateStartState();
+            ROCKSAMPLE_STATE& rockstate = safe_cast<ROCKSAMPLE_STATE&>(*state);
+            rockstate.AgentPos = COORD(rock % 7, 6 - rock % 5);
+            int realObs = n % 2 ? E_GOOD : E_BAD;
+            int stepObs = realObs == E_GOOD ? E_BAD : E_GOOD;
+            HISTORY checked;
+            checked.Add(rock + 1 + E_SAMPLE, realObs);
+            numAccepted += rocksample.LocalMove(*state, checked, stepObs, status);
+            likelihood += rocksample.ObservationProbability(*state, rock + 1 + E_SAMPLE,
+                realObs, stepObs);
+            rocksample.FreeState(state);
+        }
+        assert(fabs(numAccepted - likelihood) < 4 * sqrt(numMoves * 0.25));
+    }
+
+    STATE* state = rocksample.CreateStartState();
+    int observation;
+    RC rewardcost;
+    rocksample.Step(*state, COORD::E_NORTH, observation, rewardcost);
+    assert(rocksample.ObservationProbability(*state, COORD::E_NORTH, E_NONE, observation) == 1);
+    assert(rocksample.ObservationProbability(*state, COORD::E_NORTH, E_GOOD, observation) == 0);
+    rocksample.FreeState(state);
+}
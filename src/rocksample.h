@@ -4,24 +4,64 @@
 #include "simulator.h"
 #include "coord.h"
 #include "grid.h"
+#include <stdint.h>
 
+// Rocks are stored inline, with one bit per rock for each flag, so that a
+// state is a few dozen bytes and copying it never allocates.
 class ROCKSAMPLE_STATE : public STATE
 {
 public:
 
+    enum { MaxRocks = 16 };
+
     COORD AgentPos;
-    struct ENTRY
-    {
-        bool Valuable;
-        bool Collected;
-        int Count;    				// Smart knowledge
-        int Measured; 				// Smart knowledge
-        double LikelihoodValuable;	// Smart knowledge
-        double LikelihoodWorthless;	// Smart knowledge
-        double ProbValuable;		// Smart knowledge
-    };
-    std::vector<ENTRY> Rocks;
     int Target; // Smart knowledge
+
+    bool Valuable(int rock) const { return (ValuableBits >> rock) & 1; }
+    bool Collected(int rock) const { return (CollectedBits >> rock) & 1; }
+    void SetValuable(int rock, bool valuable) { SetBit(ValuableBits, rock, valuable); }
+    void SetCollected(int rock, bool collected) { SetBit(CollectedBits, rock, collected); }
+
+    // Smart knowledge: the net number of good observations and the number of
+    // checks of each rock, and whether a check at full efficiency has ruled
+    // out that the rock is valuable or worthless
+    int16_t Count[MaxRocks];
+    uint8_t Measured[MaxRocks];
+    uint16_t RuledOutValuable, RuledOutWorthless;
+
+    void ClearRocks()
+    {
+        ValuableBits = CollectedBits = 0;
+        RuledOutValuable = RuledOutWorthless = 0;
+        for (int rock = 0; rock < MaxRocks; rock++)
+        {
+            Count[rock] = 0;
+            Measured[rock] = 0;
+        }
+    }
+
+    // Only the first few checks matter, so the count saturates
+    void AddMeasured(int rock)
+    {
+        if (Measured[rock] < 255)
+            Measured[rock]++;
+    }
+
+    // A check that gave a definite answer, so that the probability of the
+    // rock being valuable is exactly 0 or 1
+    bool Certain(int rock) const
+    {
+        return ((RuledOutValuable ^ RuledOutWorthless) >> rock) & 1;
+    }
+
+private:
+
+    static void SetBit(uint16_t& bits, int rock, bool value)
+    {
+        bits = value ? bits | (1 << rock) : bits & ~(1 << rock);
+    }
+
+    uint16_t ValuableBits, CollectedBits;
 };
 
 class ROCKSAMPLE : public SIMULATOR
@@ -43,6 +83,13 @@ public:
         std::vector<int>& legal, const STATUS& status) const;
     virtual bool LocalMove(STATE& state, const HISTORY& history,
         int stepObservation, const STATUS& status) const;
+    virtual double ObservationProbability(const STATE& state, int action,
+        int observation, int stepObs) const;
+    virtual void ConditionObservation(STATE& state, int action,
+        int observation, int stepObs) const;
+    virtual void RolloutBatch(STATE** states, int numStates,
+        HISTORY& history, const STATUS& status, int maxSteps,
+        RC* returns, int* numSteps) const;
 
     virtual void DisplayBeliefs(const BELIEF_STATE& beliefState,
         std::ostream& ostr) const;
@@ -50,6 +97,8 @@ public:
     virtual void DisplayObservation(const STATE& state, int observation, std::ostream& ostr) const;
     virtual void DisplayAction(int action, std::ostream& ostr) const;
 
+    static void UnitTest();
+
 protected:
 
     enum
@@ -72,6 +121,19 @@ protected:
     int GetObservation(const ROCKSAMPLE_STATE& rockstate, int rock) const;
     int SelectTarget(const ROCKSAMPLE_STATE& rockstate) const;
 
+    // Probability that checking rock from pos reports its true value
+    double GetEfficiency(const COORD& pos, int rock) const
+    {
+        assert(Grid.Inside(pos) && rock >= 0 && rock < NumRocks);
+        return Efficiency[Grid.Index(pos) * NumRocks + rock];
+    }
+
+    // Batched rollouts advance the states of a batch together, held as
+    // structure of arrays
+    struct LANES;
+    int SelectRollout(const LANES& lanes, int lane) const;
+    bool StepRollout(LANES& lanes, int lane, int action) const;
+
     GRID<int> Grid;
     std::vector<COORD> RockPos;
     int Size, NumRocks;
@@ -79,6 +141,9 @@ protected:
     double HalfEfficiencyDistance;
     double SmartMoveProb;
     int UncertaintyCount;
+    std::vector<double> Efficiency;
+    // Rocks lying north or south of each row, and west or east of each column
+    std::vector<uint16_t> NorthOf, SouthOf, WestOf, EastOf;
 
 private:
 
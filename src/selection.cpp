@@ -0,0 +1,395 @@
+#include "selection.h"
+#include "utils.h"
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SELECTION_AVX2
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace UTILS;
+
+namespace SELECTION
+{
+
+//-----------------------------------------------------------------------------
+// Scalar kernels
+
+static inline void EvaluateAction(const EVALUATION& eval, int action,
+    double* q, double* c, int* n)
+{
+    int count = eval.Counts[action];
+    double R = count == 0 ? eval.TotalR[action] : eval.TotalR[action] / count;
+    double C = count == 0 ? eval.TotalC[action] : eval.TotalC[action] / count;
+    double Q = R - eval.Lambda * C;
+
+    // Each descent in progress counts as VirtualLossScale visits with the
+    // worst return
+    int virtualLoss = eval.VirtualLoss
+        ? __atomic_load_n(&eval.VirtualLoss[action], __ATOMIC_RELAXED) : 0;
+    if (virtualLoss != 0)
+    {
+        int virtualCount = virtualLoss * eval.VirtualLossScale;
+        Q = (count * Q - virtualCount * eval.RewardRange) / (count + virtualCount);
+        count += virtualCount;
+    }
+
+    q[action] = Q;
+    c[action] = C;
+    n[action] = count;
+}
+
+static void EvaluateScalar(int numActions, const EVALUATION& eval,
+    double* q, double* c, int* n)
+{
+    for (int action = 0; action < numActions; action++)
+        EvaluateAction(eval, action, q, c, n);
+}
+
+static inline double Bonus(const BONUS& bonus, int n)
+{
+    if (n == 0)
+        return Infinity;
+    double scale = bonus.Table && n < bonus.TableSize
+        ? bonus.Table[n] : bonus.Exploration / sqrt(n);
+    return scale * bonus.SqrtLogN;
+}
+
+void FillBonusTable(double exploration, int tableSize, double* table)
+{
+    for (int n = 0; n < tableSize; n++)
+        table[n] = n == 0 ? Infinity : exploration / sqrt(n);
+}
+
+static int SelectBestScalar(int numActions, const double* q, const double* c,
+    const int* n, const BONUS* bonus, bool limitCost, double costLimit,
+    double* qplus, int* best)
+{
+    int numBest = 0;
+    double bestQplus = -Infinity;
+    for (int action = 0; action < numActions; action++)
+    {
+        double Qplus = q[action];
+        if (bonus)
+            Qplus += Bonus(*bonus, n[action]);
+        qplus[action] = Qplus;
+        if (limitCost && !(c[action] < costLimit))
+            continue;
+        if (Qplus >= bestQplus)
+        {
+            if (Qplus > bestQplus)
+                numBest = 0;
+            bestQplus = Qplus;
+            best[numBest++] = action;
+        }
+    }
+    return numBest;
+}
+
+static int WithinScalar(int numActions, const double* q, double bestQ,
+    double bound, int* within)
+{
+    int numWithin = 0;
+    for (int action = 0; action < numActions; action++)
+        if (fabs(bestQ - q[action]) <= bound)
+            within[numWithin++] = action;
+    return numWithin;
+}
+
+//-----------------------------------------------------------------------------
+// AVX2 kernels, four actions at a time. They avoid fused multiply-add so that
+// every operation rounds exactly as in the scalar kernels, and handle the
+// remaining actions with inlined scalar code rather than calling out to
+// non-VEX functions with the upper halves of the registers in use.
+
+#ifdef SELECTION_AVX2
+
+__attribute__((target("avx2")))
+static void EvaluateAvx2(int numActions, const EVALUATION& eval,
+    double* q, double* c, int* n)
+{
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d lambda = _mm256_set1_pd(eval.Lambda);
+    const __m256d range = _mm256_set1_pd(eval.RewardRange);
+    const __m128i scale = _mm_set1_epi32(eval.VirtualLossScale);
+
+    int action = 0;
+    for (; action + 4 <= numActions; action += 4)
+    {
+        __m128i count = _mm_loadu_si128((const __m128i*) &eval.Counts[action]);
+        __m256d countd = _mm256_cvtepi32_pd(count);
+        __m256d unvisited = _mm256_cmp_pd(countd, zero, _CMP_EQ_OQ);
+        __m256d totalR = _mm256_loadu_pd(&eval.TotalR[action]);
+        __m256d totalC = _mm256_loadu_pd(&eval.TotalC[action]);
+        __m256d R = _mm256_blendv_pd(_mm256_div_pd(totalR, countd), totalR, unvisited);
+        __m256d C = _mm256_blendv_pd(_mm256_div_pd(totalC, countd), totalC, unvisited);
+        __m256d Q = _mm256_sub_pd(R, _mm256_mul_pd(lambda, C));
+
+        if (eval.VirtualLoss)
+        {
+            __m128i virtualLoss = _mm_loadu_si128((const __m128i*) &eval.VirtualLoss[action]);
+            __m128i loaded = _mm_xor_si128(_mm_cmpeq_epi32(virtualLoss, _mm_setzero_si128()),
+                _mm_set1_epi32(-1));
+            if (!_mm_testz_si128(loaded, loaded))
+            {
+                __m128i virtualCount = _mm_and_si128(_mm_mullo_epi32(virtualLoss, scale), loaded);
+                __m256d virtualCountd = _mm256_cvtepi32_pd(virtualCount);
+                __m256d lossQ = _mm256_div_pd(
+                    _mm256_sub_pd(_mm256_mul_pd(countd, Q), _mm256_mul_pd(virtualCountd, range)),
+                    _mm256_cvtepi32_pd(_mm_add_epi32(count, virtualCount)));
+                Q = _mm256_blendv_pd(Q, lossQ, _mm256_castsi256_pd(_mm256_cvtepi32_epi64(loaded)));
+                count = _mm_add_epi32(count, virtualCount);
+            }
+        }
+
+        _mm256_storeu_pd(&q[action], Q);
+        _mm256_storeu_pd(&c[action], C);
+        _mm_storeu_si128((__m128i*) &n[action], count);
+    }
+
+    for (; action < numActions; action++)
+        EvaluateAction(eval, action, q, c, n);
+}
+
+__attribute__((target("avx2")))
+static int SelectBestAvx2(int numActions, const double* q, const double* c,
+    const int* n, const BONUS* bonus, bool limitCost, double costLimit,
+    double* qplus, int* best)
+{
+    const __m256d nan = _mm256_set1_pd(NAN);
+    const __m256d infinity = _mm256_set1_pd(Infinity);
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d limit = _mm256_set1_pd(costLimit);
+    __m256d exploration = zero, sqrtLogN = zero;
+    __m128i tableSize = _mm_setzero_si128();
+    if (bonus)
+    {
+        exploration = _mm256_set1_pd(bonus->Exploration);
+        sqrtLogN = _mm256_set1_pd(bonus->SqrtLogN);
+        tableSize = _mm_set1_epi32(bonus->Table ? bonus->TableSize : 0);
+    }
+
+    // Q plus bonus of each action, with excluded actions set to NaN so that
+    // they never compare equal to the maximum
+    __m256d maxQplus = _mm256_set1_pd(-Infinity);
+    int action = 0;
+    for (; action + 4 <= numActions; action += 4)
+    {
+        __m256d Qplus = _mm256_loadu_pd(&q[action]);
+        if (bonus)
+        {
+            __m128i count = _mm_loadu_si128((const __m128i*) &n[action]);
+            __m256d countd = _mm256_cvtepi32_pd(count);
+            __m128i inTable = _mm_cmplt_epi32(count, tableSize);
+            __m256d scale;
+            if (_mm_movemask_epi8(inTable) == 0xffff)
+                scale = _mm256_i32gather_pd(bonus->Table, count, 8);
+            else
+            {
+                scale = _mm256_div_pd(exploration, _mm256_sqrt_pd(countd));
+                if (!_mm_testz_si128(inTable, inTable))
+                    scale = _mm256_mask_i32gather_pd(scale, bonus->Table, count,
+                        _mm256_castsi256_pd(_mm256_cvtepi32_epi64(inTable)), 8);
+            }
+            __m256d ucb = _mm256_mul_pd(scale, sqrtLogN);
+            ucb = _mm256_blendv_pd(ucb, infinity, _mm256_cmp_pd(countd, zero, _CMP_EQ_OQ));
+            Qplus = _mm256_add_pd(Qplus, ucb);
+        }
+        _mm256_storeu_pd(&qplus[action], Qplus);
+        if (limitCost)
+            Qplus = _mm256_blendv_pd(nan, Qplus,
+                _mm256_cmp_pd(_mm256_loadu_pd(&c[action]), limit, _CMP_LT_OQ));
+        // Keeps the running maximum where Qplus is NaN
+        maxQplus = _mm256_max_pd(Qplus, maxQplus);
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, maxQplus);
+    double bestQplus = -Infinity;
+    for (int i = 0; i < 4; i++)
+        if (lanes[i] > bestQplus)
+            bestQplus = lanes[i];
+    for (int tail = action; tail < numActions; tail++)
+    {
+        double Qplus = q[tail];
+        if (bonus)
+            Qplus += Bonus(*bonus, n[tail]);
+        qplus[tail] = Qplus;
+        if ((!limitCost || c[tail] < costLimit) && Qplus > bestQplus)
+            bestQplus = Qplus;
+    }
+
+    int numBest = 0;
+    const __m256d bestv = _mm256_set1_pd(bestQplus);
+    for (action = 0; action + 4 <= numActions; action += 4)
+    {
+        __m256d mask = _mm256_cmp_pd(_mm256_loadu_pd(&qplus[action]), bestv, _CMP_EQ_OQ);
+        if (limitCost)
+            mask = _mm256_and_pd(mask,
+                _mm256_cmp_pd(_mm256_loadu_pd(&c[action]), limit, _CMP_LT_OQ));
+        for (int bits = _mm256_movemask_pd(mask); bits; bits &= bits - 1)
+            best[numBest++] = action + __builtin_ctz(bits);
+    }
+    for (; action < numActions; action++)
+        if ((!limitCost || c[action] < costLimit) && qplus[action] == bestQplus)
+            best[numBest++] = action;
+    return numBest;
+}
+
+__attribute__((target("avx2")))
+static int WithinAvx2(int numActions, const double* q, double bestQ,
+    double bound, int* within)
+{
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    const __m256d bestv = _mm256_set1_pd(bestQ);
+    const __m256d boundv = _mm256_set1_pd(bound);
+
+    int numWithin = 0;
+    int action = 0;
+    for (; action + 4 <= numActions; action += 4)
+    {
+        __m256d diff = _mm256_andnot_pd(sign, _mm256_sub_pd(bestv, _mm256_loadu_pd(&q[action])));
+        int bits = _mm256_movemask_pd(_mm256_cmp_pd(diff, boundv, _CMP_LE_OQ));
+        for (; bits; bits &= bits - 1)
+            within[numWithin++] = action + __builtin_ctz(bits);
+    }
+    for (; action < numActions; action++)
+        if (fabs(bestQ - q[action]) <= bound)
+            within[numWithin++] = action;
+    return numWithin;
+}
+
+static bool HasAvx2()
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+#else
+
+static bool HasAvx2()
+{
+    return false;
+}
+
+#endif // SELECTION_AVX2
+
+//-----------------------------------------------------------------------------
+
+static bool UseAvx2 = HasAvx2();
+
+void SetVectorised(bool vectorised)
+{
+    UseAvx2 = vectorised && HasAvx2();
+}
+
+bool Vectorised()
+{
+    return UseAvx2;
+}
+
+void Evaluate(int numActions, const EVALUATION& eval,
+    double* q, double* c, int* n)
+{
+#ifdef SELECTION_AVX2
+    if (UseAvx2)
+        return EvaluateAvx2(numActions, eval, q, c, n);
+#endif
+    EvaluateScalar(numActions, eval, q, c, n);
+}
+
+int SelectBest(int numActions, const double* q, const double* c,
+    const int* n, const BONUS* bonus, bool limitCost, double costLimit,
+    double* qplus, int* best)
+{
+#ifdef SELECTION_AVX2
+    if (UseAvx2)
+        return SelectBestAvx2(numActions, q, c, n, bonus, limitCost, costLimit,
+            qplus, best);
+#endif
+    return SelectBestScalar(numActions, q, c, n, bonus, limitCost, costLimit,
+        qplus, best);
+}
+
+int Within(int numActions, const double* q, double bestQ, double bound,
+    int* within)
+{
+#ifdef SELECTION_AVX2
+    if (UseAvx2)
+        return WithinAvx2(numActions, q, bestQ, bound, within);
+#endif
+    return WithinScalar(numActions, q, bestQ, bound, within);
+}
+
+//-----------------------------------------------------------------------------
+
+void UnitTest()
+{
+    // Vectorised and scalar kernels agree exactly, including ties, unvisited
+    // actions, virtual loss, table lookups and cost limits
+    if (!HasAvx2())
+        return;
+
+    const int maxActions = 23;
+    vector<double> table(16);
+    FillBonusTable(3.0, 16, &table[0]);
+
+    for (int trial = 0; trial < 2000; trial++)
+    {
+        int numActions = Random(1, maxActions + 1);
+        vector<int> counts(numActions), virtualLoss(numActions);
+        vector<double> totalR(numActions), totalC(numActions);
+        for (int a = 0; a < numActions; a++)
+        {
+            counts[a] = Random(4) == 0 ? 0 : Random(40);
+            // Coarse values so that ties are common
+            totalR[a] = counts[a] * (Random(5) - 2) * 0.5;
+            totalC[a] = counts[a] * Random(3) * 0.25;
+            virtualLoss[a] = Random(3) == 0 ? Random(3) : 0;
+        }
+
+        EVALUATION eval;
+        eval.Counts = &counts[0];
+        eval.TotalR = &totalR[0];
+        eval.TotalC = &totalC[0];
+        eval.VirtualLoss = (trial % 2) ? &virtualLoss[0] : 0;
+        eval.VirtualLossScale = 1 + trial % 3;
+        eval.RewardRange = 20;
+        eval.Lambda = (trial % 5) * 0.3;
+
+        BONUS bonus;
+        bonus.Table = (trial % 3) ? &table[0] : 0;
+        bonus.TableSize = 16;
+        bonus.Exploration = 3.0;
+        bonus.SqrtLogN = sqrt(log(50.0));
+        const BONUS* bonusp = (trial % 4) ? &bonus : 0;
+        bool limitCost = trial % 7 == 0;
+
+        vector<double> q[2], c[2], qplus[2];
+        vector<int> n[2], best[2], within[2];
+        for (int v = 0; v < 2; v++)
+        {
+            SetVectorised(v == 1);
+            q[v].resize(numActions);
+            c[v].resize(numActions);
+            qplus[v].resize(numActions);
+            n[v].resize(numActions);
+            best[v].resize(numActions);
+            within[v].resize(numActions);
+            Evaluate(numActions, eval, &q[v][0], &c[v][0], &n[v][0]);
+            int numBest = SelectBest(numActions, &q[v][0], &c[v][0], &n[v][0],
+                bonusp, limitCost, 0.3, &qplus[v][0], &best[v][0]);
+            best[v].resize(numBest);
+            double bestQ = numBest > 0 ? q[v][best[v].back()] : 0;
+            int numWithin = Within(numActions, &q[v][0], bestQ, 0.5, &within[v][0]);
+            within[v].resize(numWithin);
+        }
+        assert(q[0] == q[1] && c[0] == c[1] && n[0] == n[1]);
+        assert(qplus[0] == qplus[1]);
+        assert(best[0] == best[1]);
+        assert(within[0] == within[1]);
+    }
+    SetVectorised(true);
+}
+
+}
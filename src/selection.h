@@ -0,0 +1,65 @@
+#ifndef SELECTION_H
+#define SELECTION_H
+
+//-----------------------------------------------------------------------------
+// Kernels for the action selection of MCTS::GreedyUCB, operating on the
+// contiguous per-action statistics of a VNODE. Each kernel has a scalar
+// version and, on x86, an AVX2 version chosen at run time when the CPU
+// supports it. Both produce bit-identical results.
+
+namespace SELECTION
+{
+
+struct EVALUATION
+{
+    const int* Counts;
+    const double* TotalR;
+    const double* TotalC;
+    // Descents in progress per action, or 0 when there is no virtual loss
+    const int* VirtualLoss;
+    int VirtualLossScale;
+    double RewardRange;
+    double Lambda;
+};
+
+// The UCB bonus Exploration sqrt(log(N + 1) / n) of an action tried n times
+// at a node visited N times, factored as Exploration / sqrt(n), looked up in
+// a small table filled by FillBonusTable, times sqrt(log(N + 1)) computed
+// once per node
+struct BONUS
+{
+    // Exploration / sqrt(n) for counts below TableSize, or 0 if there is no
+    // table
+    const double* Table;
+    int TableSize;
+    double Exploration, SqrtLogN;
+};
+
+void FillBonusTable(double exploration, int tableSize, double* table);
+
+// Scalarized value Q = R - lambda C, mean cost C and count n of each action
+void Evaluate(int numActions, const EVALUATION& eval,
+    double* q, double* c, int* n);
+
+// Collect the actions maximising Q plus UCB bonus (no bonus if bonus is 0),
+// in increasing order, restricted to actions with cost below costLimit if
+// limitCost is set. Q plus bonus is left in qplus. Returns the number of
+// actions written to best.
+int SelectBest(int numActions, const double* q, const double* c,
+    const int* n, const BONUS* bonus, bool limitCost, double costLimit,
+    double* qplus, int* best);
+
+// Collect the actions whose Q lies within bound of bestQ
+int Within(int numActions, const double* q, double bestQ, double bound,
+    int* within);
+
+// Use the vectorised kernels when available (the default), or force the
+// scalar ones
+void SetVectorised(bool vectorised);
+bool Vectorised();
+
+void UnitTest();
+
+}
+
+#endif // SELECTION_H
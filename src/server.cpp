@@ -0,0 +1,275 @@
+#include "server.h"
+#include "testsimulator.h"
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace std;
+using namespace UTILS;
+
+SERVER::PARAMS::PARAMS()
+:   NumWorkers(4)
+{
+}
+
+SERVER::SERVER(const SIMULATOR& simulator, const MCTS::PARAMS& searchParams,
+    const PARAMS& params)
+:   Simulator(simulator),
+    SearchParams(searchParams),
+    Params(params),
+    Stopping(false),
+    Output(0)
+{
+    // Output would be mixed into the replies
+    SearchParams.Verbose = 0;
+    // Every search runs on the worker serving its session, so that the
+    // workers bound the threads searching and share them round robin
+    SearchParams.Ponder = false;
+    SearchParams.NumThreads = 1;
+}
+
+SERVER::~SERVER()
+{
+    for (map<string, SESSION*>::iterator i = Sessions.begin(); i != Sessions.end(); ++i)
+    {
+        delete i->second->Search;
+        delete i->second;
+    }
+}
+
+void SERVER::Serve(istream& input, ostream& output)
+{
+    Output = &output;
+    Stopping = false;
+    vector<thread> workers;
+    for (int i = 0; i < Params.NumWorkers; i++)
+        workers.push_back(thread(&SERVER::Worker, this));
+
+    string line;
+    while (getline(input, line))
+    {
+        istringstream request(line);
+        string command, id;
+        request >> command >> id;
+        if (command.empty())
+            continue;
+        if (command == "quit")
+            break;
+        if (id.empty())
+        {
+            Reply("error - missing session id");
+            continue;
+        }
+
+        lock_guard<mutex> lock(Mutex);
+        SESSION*& session = Sessions[id];
+        if (!session)
+            session = new SESSION;
+        session->Requests.push_back(line);
+        if (!session->Scheduled)
+        {
+            session->Scheduled = true;
+            Ready.push_back(id);
+            Wakeup.notify_one();
+        }
+    }
+
+    {
+        lock_guard<mutex> lock(Mutex);
+        Stopping = true;
+    }
+    Wakeup.notify_all();
+    for (int i = 0; i < (int) workers.size(); i++)
+        workers[i].join();
+    Output = 0;
+}
+
+void SERVER::Worker()
+{
+    unique_lock<mutex> lock(Mutex);
+    while (true)
+    {
+        while (Ready.empty() && !Stopping)
+            Wakeup.wait(lock);
+        // Workers still serving may put their sessions back, and will
+        // serve them themselves
+        if (Ready.empty())
+            return;
+
+        string id = Ready.front();
+        Ready.pop_front();
+        SESSION* session = Sessions[id];
+        string request = session->Requests.front();
+        session->Requests.pop_front();
+        lock.unlock();
+
+        swap(Generator(), session->Generator);
+        string reply = Handle(id, *session, request);
+        swap(Generator(), session->Generator);
+        Reply(reply);
+
+        lock.lock();
+        if (!session->Requests.empty())
+        {
+            // To the back of the queue, behind the other sessions
+            Ready.push_back(id);
+            Wakeup.notify_one();
+        }
+        else
+        {
+            session->Scheduled = false;
+            if (!session->Search)
+            {
+                Sessions.erase(id);
+                delete session;
+            }
+        }
+    }
+}
+
+string SERVER::Handle(const string& id, SESSION& session, const string& line)
+{
+    istringstream request(line);
+    string command, skip;
+    request >> command >> skip;
+    ostringstream reply;
+
+    if (command == "open")
+    {
+        if (session.Search)
+            return "error " + id + " already open";
+        uint64_t seed = 0;
+        if (!(request >> seed))
+            seed = 0;
+        RandomSeed(seed);
+        session.Search = new MCTS(Simulator, SearchParams);
+        reply << "opened " << id;
+        return reply.str();
+    }
+
+    if (!session.Search)
+        return "error " + id + " not open";
+
+    if (command == "close")
+    {
+        delete session.Search;
+        session.Search = 0;
+        reply << "closed " << id;
+    }
+    else if (session.Lost)
+        reply << "error " << id << " out of particles";
+    else if (command == "select")
+    {
+        session.LastPolicy = session.Search->SelectAction();
+        session.LastAction = session.LastPolicy.sampleAction();
+        session.Selected = true;
+        reply << "action " << id << " " << session.LastAction;
+    }
+    else if (command == "update")
+    {
+        int observation;
+        RC rewardcost;
+        if (!(request >> observation >> rewardcost.R >> rewardcost.C)
+            || observation < 0 || observation >= Simulator.GetNumObservations())
+            return "error " + id + " bad update";
+        if (!session.Selected)
+            return "error " + id + " no action selected";
+
+        // As in EXPERIMENT::Run
+        MCTS& mcts = *session.Search;
+        mcts.setAdmissibleCost(mcts.getNextAdmissibleCost(
+            session.LastPolicy, session.LastAction, rewardcost));
+        session.Selected = false;
+        if (mcts.Update(session.LastAction, observation, rewardcost))
+            reply << "updated " << id;
+        else
+        {
+            session.Lost = true;
+            reply << "error " << id << " out of particles";
+        }
+    }
+    else
+        reply << "error " << id << " unknown request " << command;
+    return reply.str();
+}
+
+void SERVER::Reply(const string& reply)
+{
+    lock_guard<mutex> lock(OutputMutex);
+    *Output << reply << endl;
+}
+
+//----------------------------------------------------------------------------
+
+void SERVER::UnitTest()
+{
+    TEST_SIMULATOR simulator(3, 2, 2);
+    MCTS::PARAMS searchParams;
+    searchParams.MaxDepth = 3;
+    searchParams.NumSimulations = 200;
+    searchParams.NumStartStates = 10;
+    searchParams.c_hat = Infinity;
+    searchParams.TreeAlgorithm = 1;
+    // Ignored by the server, or sessions a and b could differ
+    searchParams.NumThreads = 4;
+    searchParams.Ponder = true;
+    PARAMS params;
+    params.NumWorkers = 3;
+
+    // Sessions a and b share a seed and requests, so choose the same
+    // actions however they are scheduled. Session c is unrelated.
+    const char* sessions[] = { "a", "b", "c" };
+    ostringstream requests;
+    for (int s = 0; s < 3; s++)
+        requests << "open " << sessions[s] << (s < 2 ? " 7" : " 8") << "\n";
+    for (int step = 0; step < 3; step++)
+        for (int s = 0; s < 3; s++)
+            requests << "select " << sessions[s] << "\n"
+                << "update " << sessions[s] << " " << step % 2 << " 1 0\n";
+    requests << "update c 0 1 0\n"
+        << "select d\n"
+        << "open a\n"
+        << "update b 5 1 0\n"
+        << "frobnicate c\n";
+    for (int s = 0; s < 3; s++)
+        requests << "close " << sessions[s] << "\n";
+    requests << "quit\n" << "select a\n";
+
+    SERVER server(simulator, searchParams, params);
+    istringstream input(requests.str());
+    ostringstream output;
+    server.Serve(input, output);
+
+    map<string, vector<string> > replies;
+    istringstream lines(output.str());
+    string line;
+    while (getline(lines, line))
+    {
+        istringstream reply(line);
+        string kind, id, rest;
+        reply >> kind >> id;
+        getline(reply, rest);
+        replies[id].push_back(kind + rest);
+    }
+
+    assert(replies.size() == 4);
+    assert(replies["d"].size() == 1 && replies["d"][0] == "error not open");
+    for (int s = 0; s < 3; s++)
+    {
+        const vector<string>& r = replies[sessions[s]];
+        assert(r.front() == "opened" && r.back() == "closed");
+        for (int step = 0; step < 3; step++)
+        {
+            assert(r[1 + 2 * step].compare(0, 7, "action ") == 0);
+            assert(r[2 + 2 * step] == "updated");
+        }
+    }
+    assert(replies["a"][7] == "error already open");
+    assert(replies["b"][7] == "error bad update");
+    assert(replies["c"][7] == "error no action selected");
+    assert(replies["c"][8] == "error unknown request frobnicate");
+    for (int step = 0; step < 3; step++)
+        assert(replies["a"][1 + 2 * step] == replies["b"][1 + 2 * step]);
+}
+
+//----------------------------------------------------------------------------
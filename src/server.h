@@ -0,0 +1,99 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "mcts.h"
+#include "simulator.h"
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+
+//----------------------------------------------------------------------------
+// Long-lived planner hosting many MCTS sessions, keyed by session ID, for
+// agents whose environments run elsewhere. Requests and replies are lines
+// of text:
+//
+//   open <id> [<seed>]                      ->  opened <id>
+//   select <id>                             ->  action <id> <action>
+//   update <id> <observation> <reward> <cost>  ->  updated <id>
+//   close <id>                              ->  closed <id>
+//   quit
+//
+// update reports the outcome of the action last selected in that session.
+// Malformed or out of turn requests get "error <id> <reason>".
+//
+// A pool of workers serves the sessions round robin, one request at a time,
+// so a session never holds more than one worker and a deep search delays
+// only its own session. Searches run on the worker alone: the search
+// parameters' NumThreads and Ponder are overridden. Each session's replies come in the order of its
+// requests, but replies of different sessions may interleave. Every
+// session draws from its own random generator, so its actions depend on
+// its seed and requests alone, not on how they were scheduled.
+
+class SERVER
+{
+public:
+
+    struct PARAMS
+    {
+        PARAMS();
+
+        int NumWorkers;
+    };
+
+    SERVER(const SIMULATOR& simulator, const MCTS::PARAMS& searchParams,
+        const PARAMS& params);
+    ~SERVER();
+
+    // Serve requests from input until it ends or a quit request, then
+    // finish the requests already read
+    void Serve(std::istream& input, std::ostream& output);
+
+    static void UnitTest();
+
+private:
+
+    struct SESSION
+    {
+        SESSION() : Search(0), Scheduled(false), Selected(false), Lost(false) { }
+
+        MCTS* Search;
+        RANDOM_GENERATOR Generator;
+        // Requests not yet served
+        std::deque<std::string> Requests;
+        // Waiting in the ready queue, or being served
+        bool Scheduled;
+        // The policy and action of the last select, awaiting update
+        Policy LastPolicy;
+        int LastAction;
+        bool Selected;
+        // Update ran out of particles, so the session can no longer plan
+        bool Lost;
+    };
+
+    void Worker();
+    std::string Handle(const std::string& id, SESSION& session,
+        const std::string& request);
+    void Reply(const std::string& reply);
+
+    const SIMULATOR& Simulator;
+    MCTS::PARAMS SearchParams;
+    PARAMS Params;
+
+    // Guards Sessions, Ready and Stopping
+    std::mutex Mutex;
+    std::condition_variable Wakeup;
+    std::map<std::string, SESSION*> Sessions;
+    // Sessions with pending requests, in the order they will be served
+    std::deque<std::string> Ready;
+    bool Stopping;
+
+    std::mutex OutputMutex;
+    std::ostream* Output;
+};
+
+//----------------------------------------------------------------------------
+
+#endif // SERVER_H
@@ -28,7 +28,8 @@ SIMULATOR::SIMULATOR()
 SIMULATOR::SIMULATOR(int numActions, int numObservations, double discount)
 :   NumActions(numActions),
     NumObservations(numObservations),
-    Discount(discount)
+    Discount(discount),
+    RewardRange(1.0)
 { 
     assert(discount > 0 && discount <= 1);
 }
@@ -47,6 +48,17 @@ bool SIMULATOR::LocalMove(STATE& state, const HISTORY& history,
     return true;
 }
 
+double SIMULATOR::ObservationProbability(const STATE& state, int action,
+    int observation, int stepObs) const
+{
+    return stepObs == observation ? 1 : 0;
+}
+
+void SIMULATOR::ConditionObservation(STATE& state, int action,
+    int observation, int stepObs) const
+{
+}
+
 void SIMULATOR::GenerateLegal(const STATE& state, const HISTORY& history, 
     std::vector<int>& actions, const STATUS& status) const
 {
@@ -62,7 +74,7 @@ void SIMULATOR::GeneratePreferred(const STATE& state, const HISTORY& history,
 int SIMULATOR::SelectRandom(const STATE& state, const HISTORY& history,
     const STATUS& status) const
 {
-    static vector<int> actions;
+    static thread_local vector<int> actions;
 
     if (Knowledge.RolloutLevel >= KNOWLEDGE::SMART)
     {
@@ -83,10 +95,39 @@ int SIMULATOR::SelectRandom(const STATE& state, const HISTORY& history,
     return Random(NumActions);
 }
 
+void SIMULATOR::RolloutBatch(STATE** states, int numStates,
+    HISTORY& history, const STATUS& status, int maxSteps,
+    RC* returns, int* numSteps) const
+{
+    int historyDepth = history.Size();
+    for (int i = 0; i < numStates; ++i)
+    {
+        RC totalRewardCost(0.0, 0.0);
+        double discount = 1.0;
+        bool terminal = false;
+        int steps;
+        for (steps = 0; steps < maxSteps && !terminal; ++steps)
+        {
+            int observation;
+            RC rewardcost;
+
+            int action = SelectRandom(*states[i], history, status);
+            terminal = Step(*states[i], action, observation, rewardcost);
+            history.Add(action, observation);
+
+            totalRewardCost += rewardcost * discount;
+            discount *= Discount;
+        }
+        history.Truncate(historyDepth);
+        returns[i] = totalRewardCost;
+        numSteps[i] = steps;
+    }
+}
+
 void SIMULATOR::Prior(const STATE* state, const HISTORY& history,
     VNODE* vnode, const STATUS& status) const
 {
-    static vector<int> actions;
+    static thread_local vector<int> actions;
     
     if (Knowledge.TreeLevel == KNOWLEDGE::PURE || state == 0)
     {
@@ -106,7 +147,7 @@ void SIMULATOR::Prior(const STATE* state, const HISTORY& history,
         for (vector<int>::const_iterator i_action = actions.begin(); i_action != actions.end(); ++i_action)
         {
             int a = *i_action;
-            QNODE& qnode = vnode->Child(a);
+            QNODE qnode = vnode->Child(a);
             qnode.Value.Set(0, RC(0, 0));
             qnode.AMAF.Set(0, RC(0, 0));
         }
@@ -120,7 +161,7 @@ void SIMULATOR::Prior(const STATE* state, const HISTORY& history,
         for (vector<int>::const_iterator i_action = actions.begin(); i_action != actions.end(); ++i_action)
         {
             int a = *i_action;
-            QNODE& qnode = vnode->Child(a);
+            QNODE qnode = vnode->Child(a);
             qnode.Value.Set(Knowledge.SmartTreeCount, Knowledge.SmartTreeValue);
             qnode.AMAF.Set(Knowledge.SmartTreeCount, Knowledge.SmartTreeValue);
         }    
@@ -98,10 +98,26 @@ public:
     // Sanity check
     virtual void Validate(const STATE& state) const;
 
-    // Modify state stochastically to some related state
+    // Modify state stochastically to some related state. Returns false
+    // unless the new state is consistent with the history, including its
+    // last real observation; the particle filter relies on this to condition
+    // the states it accepts, and keeps their weights.
     virtual bool LocalMove(STATE& state, const HISTORY& history,
         int stepObs, const STATUS& status) const;
 
+    // Likelihood of the real observation, given that action led to state
+    // and Step reported stepObs, for weighting particles. The default is 1
+    // if the two observations agree and 0 otherwise, a one-sample estimate
+    // that suits any simulator; those with an analytic observation model
+    // should return it.
+    virtual double ObservationProbability(const STATE& state, int action,
+        int observation, int stepObs) const;
+
+    // Bring any part of state that records past observations into line
+    // with the real observation, after Step reported stepObs
+    virtual void ConditionObservation(STATE& state, int action,
+        int observation, int stepObs) const;
+
     // Use domain knowledge to assign prior value and confidence to actions
     // Should only use fully observable state variables
     void Prior(const STATE* state, const HISTORY& history, VNODE* vnode,
@@ -112,6 +128,17 @@ public:
     int SelectRandom(const STATE& state, const HISTORY& history,
         const STATUS& status) const;
 
+    // Roll out each of numStates states with SelectRandom for at most
+    // maxSteps steps or until termination, writing its discounted return to
+    // returns and the steps taken to numSteps. History holds the history
+    // leading to the states and is left unchanged. Simulators may advance
+    // the states in lockstep, and consume random numbers in a different
+    // order to single rollouts, except that a batch of one state must behave
+    // exactly as the default, which rolls out the states one at a time.
+    virtual void RolloutBatch(STATE** states, int numStates,
+        HISTORY& history, const STATUS& status, int maxSteps,
+        RC* returns, int* numSteps) const;
+
     // Generate set of legal actions
     virtual void GenerateLegal(const STATE& state, const HISTORY& history, 
         std::vector<int>& actions, const STATUS& status) const;
@@ -13,6 +13,7 @@ public:
     STATISTIC(double val, int count);
 
     void Add(double val);
+    void Merge(const STATISTIC& statistic);
     void Clear();
     int GetCount() const;
     void Initialise(double val, int count);
@@ -58,6 +59,28 @@ inline void STATISTIC::Add(double val)
         Min = val;
 }
 
+inline void STATISTIC::Merge(const STATISTIC& statistic)
+{
+    if (statistic.Count == 1)
+    {
+        Add(statistic.Mean);
+        return;
+    }
+    if (statistic.Count == 0)
+        return;
+
+    int countOld = Count;
+    double delta = statistic.Mean - Mean;
+    Count += statistic.Count;
+    Mean += delta * statistic.Count / Count;
+    Variance = (countOld * Variance + statistic.Count * statistic.Variance
+                  + delta * delta * countOld * statistic.Count / Count) / Count;
+    if (statistic.Max > Max)
+        Max = statistic.Max;
+    if (statistic.Min < Min)
+        Min = statistic.Min;
+}
+
 inline void STATISTIC::Clear()
 {
     Count = 0;
@@ -0,0 +1,38 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <chrono>
+
+//----------------------------------------------------------------------------
+// Monotonic wall-clock timer. Unlike boost::timer, which measures the CPU
+// time of the whole process, it stays correct when several threads run.
+
+class TIMER
+{
+public:
+
+    TIMER()
+    {
+        Restart();
+    }
+
+    void Restart()
+    {
+        Start = std::chrono::steady_clock::now();
+    }
+
+    // Seconds since construction or the last restart
+    double Elapsed() const
+    {
+        return std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - Start).count();
+    }
+
+private:
+
+    std::chrono::steady_clock::time_point Start;
+};
+
+//----------------------------------------------------------------------------
+
+#endif // TIMER_H
@@ -1,4 +1,6 @@
 #include "utils.h"
+#include "arena.h"
+#include <thread>
 
 namespace UTILS
 {
@@ -23,6 +25,23 @@ void UnitTest()
     for (int i = 0; i < 10000; i++)
         c += Bernoulli(0.5);
     assert(Near(c, 5000, 250));
+
+    // Same seed and stream reproduce the sequence, other streams differ
+    uint64_t x[3];
+    for (int stream = 0; stream < 3; stream++)
+    {
+        RandomSeed(42, stream % 2);
+        x[stream] = Generator().Next();
+    }
+    assert(x[0] == x[2]);
+    assert(x[0] != x[1]);
+    for (int i = 0; i < 10000; i++)
+    {
+        double d = RandomDouble(-1, 1);
+        assert(d >= -1 && d < 1);
+        int r = Random(3, 7);
+        assert(r >= 3 && r < 7);
+    }
     assert(CheckFlag(5, 0));
     assert(!CheckFlag(5, 1));
     assert(CheckFlag(5, 2));
@@ -31,6 +50,59 @@ void UnitTest()
     SetFlag(flag, 2);
     SetFlag(flag, 4);
     assert(flag == 21);
+
+    // Objects allocated by one thread and freed by another are handed out
+    // once at a time, and the per-thread counts add up
+    struct POOLED : public MEMORY_OBJECT { int Value; };
+    MEMORY_POOL<POOLED> pool;
+    const int numThreads = 4, numObjects = 1000;
+    std::vector<POOLED*> objects[numThreads];
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; t++)
+        threads.push_back(std::thread([&pool, &objects, t]()
+        {
+            for (int i = 0; i < numObjects; i++)
+                objects[t].push_back(pool.Allocate());
+            for (int i = 0; i < numObjects / 2; i++)
+            {
+                pool.Free(objects[t].back());
+                objects[t].pop_back();
+            }
+        }));
+    for (int t = 0; t < numThreads; t++)
+        threads[t].join();
+    assert(pool.GetNumAllocated() == numThreads * numObjects / 2);
+    std::vector<POOLED*> live;
+    for (int t = 0; t < numThreads; t++)
+        live.insert(live.end(), objects[t].begin(), objects[t].end());
+    std::sort(live.begin(), live.end());
+    assert(std::adjacent_find(live.begin(), live.end()) == live.end());
+    for (int i = 0; i < (int) live.size(); i++)
+        pool.Free(live[i]);
+    assert(pool.GetNumAllocated() == 0);
+    live.clear();
+    for (int i = 0; i < numThreads * numObjects; i++)
+        live.push_back(pool.Allocate());
+    assert(pool.GetNumAllocated() == numThreads * numObjects);
+
+    // Absorbed allocations stay where they are, and the absorbing arena
+    // carries on without overwriting them
+    ARENA young(64), old(64);
+    int* kept = (int*) young.Allocate(sizeof(int));
+    *kept = 7;
+    young.Allocate(40);
+    old.Absorb(young);
+    assert(young.GetNumAllocated() == 0 && old.GetNumAllocated() == 44);
+    for (int i = 0; i < 8; i++)
+        *(int*) old.Allocate(sizeof(int)) = -1;
+    assert(*kept == 7);
+    int* reused = (int*) young.Allocate(sizeof(int));
+    *reused = -1;
+    assert(*kept == 7);
+    young.Absorb(old);
+    assert(old.GetNumAllocated() == 0 && young.GetNumAllocated() == 80);
+    old.Allocate(sizeof(int));
+    assert(*kept == 7 && *reused == -1);
 }
 
 }
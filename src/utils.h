@@ -7,6 +7,7 @@
 #include <assert.h>
 #include "coord.h"
 #include "memorypool.h"
+#include "random.h"
 #include <algorithm>
 
 #define LargeInteger 1000000
@@ -27,29 +28,40 @@ inline int Sign(int x)
     return (x > 0) - (x < 0);
 }
 
+// Each thread draws from its own generator, so that parallel search threads
+// neither contend on nor perturb each other's random streams
+inline RANDOM_GENERATOR& Generator()
+{
+    static thread_local RANDOM_GENERATOR generator;
+    return generator;
+}
+
 inline int Random(int max)
 {
-    return rand() % max;
+    return (int) (((Generator().Next() >> 32) * (uint64_t) max) >> 32);
 }
 
 inline int Random(int min, int max)
 {
-    return rand() % (max - min) + min;
+    return Random(max - min) + min;
 }
 
 inline double RandomDouble(double min, double max)
 {
-    return (double) rand() / RAND_MAX * (max - min) + min;
+    return (Generator().Next() >> 11) * (1.0 / 9007199254740992.0) * (max - min) + min;
 }
 
-inline void RandomSeed(int seed)
+// Seed this thread's generator; distinct streams of one seed never overlap
+inline void RandomSeed(uint64_t seed, int stream = 0)
 {
-    srand(seed);
+    Generator().Seed(seed);
+    for (int i = 0; i < stream; i++)
+        Generator().Jump();
 }
 
 inline bool Bernoulli(double p)
 {
-    return rand() < p * RAND_MAX;
+    return RandomDouble(0, 1) < p;
 }
 
 inline bool Near(double x, double y, double tol)
@@ -61,6 +73,18 @@ inline bool CheckFlag(int flags, int bit) { return (flags & (1 << bit)) != 0; }
 
 inline void SetFlag(int& flags, int bit) { flags = (flags | (1 << bit)); }
 
+// Lock-free accumulation into a variable shared between search threads
+template<class T>
+inline void AtomicAdd(T& target, T value)
+{
+    T expected, desired;
+    __atomic_load(&target, &expected, __ATOMIC_RELAXED);
+    do
+        desired = expected + value;
+    while (!__atomic_compare_exchange(&target, &expected, &desired, true,
+        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
 template<class T>
 inline bool Contains(std::vector<T>& vec, const T& item)
 {